@@ -1,12 +1,16 @@
 #ifndef RASTERIZER_API_H_
 #define RASTERIZER_API_H_
 
+#include "core/asset.h"
+#include "core/command_list.h"
+#include "core/framewriter.h"
 #include "core/pinnedcamera.h"
 #include "core/graphics.h"
 #include "imgui/imgui.h"
 #include "core/maths.h"
 #include "core/mesh.h"
 #include "core/platform.h"
+#include "core/postprocess.h"
 #include "core/shader.h"
 #include "core/texture.h"
 #include "SDL2/SDL.h"
@@ -0,0 +1,49 @@
+#ifndef RASTERIZER_ASSET_H_
+#define RASTERIZER_ASSET_H_
+
+#include <chrono>
+#include <future>
+
+#include "utils/ThreadPool.h"
+
+// 异步加载的资源句柄，构造时把T(args...)投递到ThreadPool上执行，
+// 加载完成前可以用占位资源渲染，例如：
+//     asset_t<texture_t> t_diffuse("cow_diffuse.png", USAGE_SRGB_COLOR);
+//     uniforms.diffuse_texture = t_diffuse.get(&placeholder);
+template <typename T>
+class asset_t {
+   public:
+    template <class... Args>
+    asset_t(const Args&... args) : resource(NULL) {
+        future = ThreadPool::enqueue([args...]() { return new T(args...); });
+    }
+    ~asset_t() {
+        wait();
+        delete resource;
+    }
+
+    asset_t(const asset_t&) = delete;
+    asset_t& operator=(const asset_t&) = delete;
+
+    bool is_ready() {
+        if(resource) return true;
+        if(future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+        resource = future.get();
+        return true;
+    }
+
+    // 未加载完成时返回placeholder，不阻塞
+    T* get(T* placeholder) { return is_ready() ? resource : placeholder; }
+
+    // 阻塞直到加载完成
+    T* wait() {
+        if(!resource && future.valid()) resource = future.get();
+        return resource;
+    }
+
+   private:
+    std::future<T*> future;
+    T* resource;
+};
+
+#endif  // RASTERIZER_ASSET_H_
@@ -22,6 +22,8 @@ class camera_t {
     void set_zoom(float _zoom);
     void set_aspect(float _aspect);
     void set_mode(projection_mode_t _mode);
+    // 投影矩阵使用reverse Z，绘制时需要使用reverse_z_depth_state()
+    void set_reverse_z(bool _reverse_z);
 
     /** getter **/
     float get_near() const;
@@ -29,11 +31,13 @@ class camera_t {
     float get_zoom() const;
     float get_aspect() const;
     projection_mode_t get_mode() const;
+    bool get_reverse_z() const;
 
    private:
     float n, f;
     float zoom, aspect;
     projection_mode_t mode;
+    bool reverse_z;
 };
 
 #endif  // RASTERIZER_CAMERA_H_
\ No newline at end of file
@@ -0,0 +1,73 @@
+#ifndef RASTERIZER_COMMAND_LIST_H_
+#define RASTERIZER_COMMAND_LIST_H_
+
+#include <vector>
+
+#include "graphics.h"
+
+// 命令列表中的一次绘制，分为vertex阶段（图元装配、vertex shader和裁剪）和光栅化两步执行。
+// 由core/pipeline.h针对具体的program实现
+class deferred_draw_t {
+   public:
+    virtual ~deferred_draw_t() {}
+    // 可以在其他线程执行，与使用其他shader对象的绘制的光栅化同时进行
+    virtual void process_vertices() = 0;
+    virtual void rasterize(framebuffer_t* framebuffer) = 0;
+    // 不保存图元，两个阶段一起执行，与draw_primitives相同
+    virtual void execute(framebuffer_t* framebuffer) = 0;
+};
+
+// 记录一帧的绘制，submit时一起执行，例如：
+//     list.draw<blin_shader_t>(cow_vbo, NULL, &shader, &uniforms, sizeof(uniforms));
+//     uniforms.model_matrix = ...;   // 不影响已经记录的绘制
+//     list.draw<blin_shader_t>(cow_vbo, NULL, &shader, &uniforms, sizeof(uniforms));
+//     list.submit(&framebuffer);
+// uniform在记录时按字节复制，其中指向的纹理、光源等在submit之前不能释放。submit时：
+//   1. 连续的、与顺序无关并且深度比较相同的绘制（不混合、不使用OIT和模板、写入深度，深度比较为
+//      LESS/LEQUAL/GREATER/GEQUAL）按shader和mesh第一次出现的顺序稳定排序，结果与记录的顺序相同，
+//      只有深度相同的像素可能取到另一个绘制的颜色；其余的绘制保持记录的顺序
+//   2. 下一个绘制的vertex阶段交给ThreadPool，与当前绘制同时执行。uniform绑定在shader对象上，
+//      两个绘制使用同一个shader对象时不能重叠；ThreadPool只有一个线程时不重叠，直接逐个绘制
+class command_list_t {
+   public:
+    command_list_t();
+    ~command_list_t();
+
+    command_list_t(const command_list_t&) = delete;
+    command_list_t& operator=(const command_list_t&) = delete;
+
+    // 参数与draw_primitives相同，uniforms为shader使用的sizeof_uniforms字节的uniform，indices可以为NULL
+    void draw(const vbo_t* data, const ibo_t* indices, shader_t* shader, const void* uniforms, int sizeof_uniforms,
+              PRIMITIVE_TYPE type = TRIANGLE, const render_state_t* state = NULL);
+
+    // 模板版本，与draw_primitives<Shader>一样需要在定义Shader的源文件里显式实例化
+    template <class Shader>
+    void draw(const vbo_t* data, const ibo_t* indices, typename type_identity<Shader>::type* shader, const void* uniforms,
+              int sizeof_uniforms, PRIMITIVE_TYPE type = TRIANGLE, const render_state_t* state = NULL);
+
+    // 执行所有记录的绘制，然后清空
+    void submit(framebuffer_t* framebuffer);
+    void clear();
+
+    int get_num_commands() const;
+
+    // 由draw调用，draw_call归命令列表所有
+    void record(deferred_draw_t* draw_call, shader_t* shader, const vbo_t* data, const render_state_t* state);
+
+   private:
+    struct command_t {
+        deferred_draw_t* draw_call;
+        shader_t* shader;
+        const vbo_t* data;
+        bool order_independent;
+        COMPARE_FUNC depth_func;
+        // 排序用：shader和mesh在命令列表中第一次出现的序号，与地址无关
+        int shader_key, data_key;
+    };
+
+    void sort_commands();
+
+    std::vector<command_t> commands;
+};
+
+#endif  // RASTERIZER_COMMAND_LIST_H_
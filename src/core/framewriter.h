@@ -0,0 +1,43 @@
+#ifndef RASTERIZER_FRAMEWRITER_H_
+#define RASTERIZER_FRAMEWRITER_H_
+
+#include <future>
+#include <string>
+
+#include "graphics.h"
+
+typedef enum {
+    FRAME_FORMAT_PPM,  // RGB8
+    FRAME_FORMAT_PNG,  // RGBA8，不压缩的deflate块
+    FRAME_FORMAT_EXR   // 线性RGBA float（RGBA8的颜色先从sRGB转换），可选附带深度通道Z
+} frame_format_t;
+
+// 在后台线程把framebuffer逐行编码写入文件，直接读取framebuffer的内存，不做整帧拷贝。
+// write()先在调用线程写入延迟清除的tile，后台线程只通过const函数读取；
+// write()立即返回，wait()返回前不能修改这个framebuffer；
+// 连续输出序列帧时用两个framebuffer交替渲染即可不阻塞渲染线程，
+// 停止输出后再次使用framebuffer前需要用is_reading()检查，必要时wait()。
+class frame_writer_t {
+   public:
+    frame_writer_t();
+    ~frame_writer_t();
+
+    frame_writer_t(const frame_writer_t&) = delete;
+    frame_writer_t& operator=(const frame_writer_t&) = delete;
+
+    // 会先等待上一帧写完
+    void write(framebuffer_t* framebuffer, const std::string& filename,
+               frame_format_t format, bool with_depth = false);
+
+    // 返回上一帧是否写入成功
+    bool wait();
+    bool is_busy();
+    // 后台是否还在读取这个framebuffer
+    bool is_reading(const framebuffer_t* framebuffer);
+
+   private:
+    std::future<bool> pending;
+    const framebuffer_t* target;
+};
+
+#endif  // RASTERIZER_FRAMEWRITER_H_
@@ -5,13 +5,20 @@
 #include "maths.h"
 #include "shader.h"
 
+// 图元类型。TRIANGLE_WIRE_FRAME只画三角形的边；TRIANGLE_STRIP的第i个三角形为顶点i, i + 1, i + 2（奇数个交换前两个，
+// 环绕方向保持一致），TRIANGLE_FAN为顶点0, i + 1, i + 2；LINES每两个顶点一条线段，LINE_STRIP相邻顶点相连；
+// 直线不画最后一个像素，屏幕空间导数为0（纹理使用第0层mipmap）
 enum PRIMITIVE_TYPE {
-    TRIANGLE, TRIANGLE_WIRE_FRAME
+    TRIANGLE, TRIANGLE_WIRE_FRAME,
+    TRIANGLE_STRIP, TRIANGLE_FAN,
+    LINES, LINE_STRIP, POINTS
 };
 
 class vbo_t {
    public:
     vbo_t(int _sizeof_element, int _count);
+    // 直接引用外部内存（例如映射的缓存文件），不拷贝也不释放
+    vbo_t(int _sizeof_element, int _count, const void* _external_data);
     ~vbo_t();
 
     vbo_t(const vbo_t&) = delete;
@@ -30,12 +37,63 @@ class vbo_t {
    private:
     int sizeof_element, count;
     char* raw_data;
+    bool owns_data;
 };
 
-// 颜色格式：从低位到高位分别为RGBA
+// 索引缓冲：图元按索引从vbo中取顶点，相邻图元共用的顶点只执行一次vertex shader。
+// 索引为primitive_restart_index时结束当前的strip/fan（或LINE_STRIP），从下一个索引开始新的一条
+const uint primitive_restart_index = 0xffffffff;
+
+class ibo_t {
+   public:
+    ibo_t(int _count);
+    ~ibo_t();
+
+    ibo_t(const ibo_t&) = delete;
+    ibo_t& operator=(const ibo_t&) = delete;
+
+    uint* data();
+    const uint* data() const;
+
+    uint& at(int p);
+    uint at(int p) const;
+
+    int get_count() const;
+
+   private:
+    int count;
+    uint* indices;
+};
+
+// 颜色缓冲的存储格式。RGBA8每个通道8位，写入时截断到[0, 1]；RGBA16F/RGBA32F保存HDR的值，不截断
+enum COLOR_FORMAT {
+    COLOR_FORMAT_RGBA8, COLOR_FORMAT_RGBA16F, COLOR_FORMAT_RGBA32F
+};
+
+// 深度缓冲的存储格式。D16/D24为[0, 1]上的定点数，D24存放在32位中
+enum DEPTH_FORMAT {
+    DEPTH_FORMAT_D16, DEPTH_FORMAT_D24, DEPTH_FORMAT_D32F
+};
+
+int get_color_format_size(COLOR_FORMAT format);
+int get_depth_format_size(DEPTH_FORMAT format);
+
+// 顺序无关的透明（OIT）的统计，见framebuffer_t::enable_oit
+struct oit_stats_t {
+    int num_fragments = 0;      // 插入链表的fragment个数
+    int num_overflows = 0;      // 节点用完后被丢弃的fragment个数
+    int max_list_length = 0;    // 最长的链表，即最多有几层透明的fragment
+};
+
+// get_color_data()返回的颜色为RGBA8，从低位到高位分别为RGBA。
+// num_samples为2或4时启用MSAA：每个采样点有独立的颜色、深度和模板值。
+// 多重采样或颜色格式不是RGBA8时，绘制后需要调用resolve()把结果转换（平均）到get_color_data()返回的颜色缓冲
 class framebuffer_t {
    public:
-    framebuffer_t(int _width, int _height);
+    framebuffer_t(int _width, int _height, int _num_samples = 1,
+                  COLOR_FORMAT _color_format = COLOR_FORMAT_RGBA8,
+                  DEPTH_FORMAT _depth_format = DEPTH_FORMAT_D32F,
+                  bool _has_stencil = false);
     ~framebuffer_t();
 
     framebuffer_t(const framebuffer_t&) = delete;
@@ -43,25 +101,255 @@ class framebuffer_t {
 
     int get_width() const;
     int get_height() const;
+    int get_num_samples() const;
+    COLOR_FORMAT get_color_format() const;
+    DEPTH_FORMAT get_depth_format() const;
+    bool has_stencil() const;
 
     void clear_color(vec4 color);
     void clear_depth(float depth);
+    void clear_stencil(uchar stencil);
 
+    // 延迟清除：只记录清除值并把所有tile标记为未清除，第一次访问某个tile时才写入。
+    // 没有画到的tile在读取整个缓冲（get_color_data等）时才写，深度没有被读取时完全不用写
+    void fast_clear_color_buffer(vec4 color);
+    void fast_clear_depth_buffer(float depth);
+
+    // 深度按深度格式量化后再返回
     float get_depth(int x, int y) const;
+    // resolve后的RGBA8颜色
     const vec4 get_color(int x, int y) const;
 
+    // 多重采样时get_depth返回第0个采样点，set_depth/set_color/set_stencil写入所有采样点
     void set_depth(int x, int y, float depth);
     void set_color(int x, int y, vec4 color);
 
+    float get_sample_depth(int x, int y, int sample) const;
+    // 颜色缓冲中保存的值，HDR格式不截断
+    const vec4 get_sample_color(int x, int y, int sample) const;
+    void set_sample_depth(int x, int y, int sample, float depth);
+    void set_sample_color(int x, int y, int sample, vec4 color);
+
+    uchar get_stencil(int x, int y, int sample = 0) const;
+    void set_stencil(int x, int y, uchar stencil);
+
+    // 不做边界检查的行指针，给光栅化的内循环使用，y的翻转和行偏移每行只算一次。
+    // y为屏幕坐标，返回的指针按x * 格式的字节数索引；调用前会写好[x0, x1]内延迟清除的tile，之后只能访问这个范围。
+    // 颜色为颜色格式下的值，单采样的RGBA8就是get_color_data()的颜色缓冲，否则需要resolve
+    void* get_depth_row(int y, int x0, int x1, int sample = 0);
+    void* get_color_row(int y, int x0, int x1, int sample = 0);
+    // 没有模板缓冲时返回NULL
+    uchar* get_stencil_row(int y, int sample = 0);
+
+    // 额外的颜色附件（MRT），返回附件的下标，fragment shader的第i个输出写入第i个附件。
+    // 第0个附件就是上面的颜色缓冲；额外的附件与它有相同的采样点个数，只支持立即清除，
+    // 不参与resolve，按采样点读取
+    int add_color_attachment(COLOR_FORMAT format);
+    int get_num_color_attachments() const;
+    COLOR_FORMAT get_attachment_format(int index) const;
+    void clear_attachment(int index, vec4 value);
+    const vec4 get_attachment_color(int index, int x, int y, int sample = 0) const;
+    // 不做边界检查的行指针，与get_color_row相同
+    void* get_attachment_row(int index, int y, int sample = 0);
+
+    // 顺序无关的透明（OIT）：render_state_t::oit为true的绘制不写深度和颜色，通过测试的fragment
+    // 插入所在像素的链表。节点在enable_oit时一次分配max_fragments个，用完后新的fragment被丢弃并计入num_overflows。
+    // resolve_oit按深度从远到近把每个像素的链表以（SRC_ALPHA, ONE_MINUS_SRC_ALPHA）混合到颜色缓冲上，
+    // 各行并行处理，之后清空链表；需要在resolve()之前调用。没有调用enable_oit时所有fragment都计为溢出
+    void enable_oit(int max_fragments);
+    // coverage为通过测试的采样点，不做边界检查
+    void insert_oit_fragment(int x, int y, float depth, const vec4& color, int coverage);
+    void resolve_oit();
+    // 丢弃链表中的fragment，不混合
+    void clear_oit();
+    // 最近一次resolve_oit或clear_oit之前的统计
+    oit_stats_t get_oit_stats() const;
+
+    // 单采样的RGBA8时什么也不做；没有画过的tile直接填清除色
+    void resolve();
+
+    // 写入所有延迟清除的tile，之后get_color_data() const / get_color_depth()返回的缓冲是完整的。
+    // const的读取函数不会修改framebuffer，可以在多个线程中同时调用；
+    // 交给其他线程读取的framebuffer要先在本线程调用它们（frame_writer_t::write会调用）
+    void materialize_color();
+    void materialize_depth();
+
+    // 需要先调用materialize_color()
     const uchar* get_color_data() const;
+    // 后处理直接修改颜色缓冲，会先写入延迟清除的tile
+    uchar* get_color_data();
+    // 只用于D32F格式，多重采样时为第0个采样点的深度；需要先调用materialize_depth()
     const float* get_color_depth() const;
 
    private:
     int width, height;
+    int num_samples;
+    COLOR_FORMAT color_format;
+    DEPTH_FORMAT depth_format;
+    int color_size, depth_size;
+    // resolve后的RGBA8颜色
     uchar* color_buffer;
-    float* depth_buffer;
+    // 按颜色格式保存的各采样点的颜色，按采样点分块存放，第s个采样点从s * width * height开始。
+    // 单采样的RGBA8与color_buffer是同一块内存
+    uchar* color_target;
+    uchar* depth_buffer;
+    uchar* stencil_buffer;
+    // 第1个及以后的颜色附件，布局与color_target相同
+    int num_attachments;
+    COLOR_FORMAT attachment_formats[max_num_of_outputs];
+    uchar* attachments[max_num_of_outputs];
+
+    bool needs_resolve() const;
+    void materialize_tile(int tile, int flags);
+    void materialize_all(int flags);
+    void materialize_span(int row, int x0, int x1, int flags);
+
+    // 延迟清除的状态，每个tile一个字节
+    int tiles_x, tiles_y;
+    uchar* tile_state;
+    int pending_flags;  // 所有tile的状态的并集，用于快速跳过materialize_all
+    // 已经按存储格式编码的清除值
+    uchar fast_clear_color[16];
+    uchar fast_clear_depth[4];
+    uint fast_clear_resolved;
+
+    // OIT的链表：每个像素一个表头（没有fragment时为-1），节点按插入顺序从oit_nodes中分配
+    struct oit_node_t {
+        vec4 color;
+        float depth;
+        int coverage;
+        int next;
+    };
+    int* oit_heads;
+    oit_node_t* oit_nodes;
+    int oit_capacity;
+    oit_stats_t oit_pending, oit_stats;
+};
+
+// 比较函数，用于模板测试（以及深度测试）
+enum COMPARE_FUNC {
+    COMPARE_NEVER, COMPARE_LESS, COMPARE_EQUAL, COMPARE_LEQUAL,
+    COMPARE_GREATER, COMPARE_NOTEQUAL, COMPARE_GEQUAL, COMPARE_ALWAYS
+};
+
+// 深度测试：depth func 已经保存的深度，通过且write为true时写入深度。默认的LEQUAL与原来的行为相同。
+// zero_to_one为true时裁剪空间的z范围为[0, w]（reverse Z的投影矩阵），深度直接取z / w，远处的浮点深度不损失精度；
+// 否则z的范围为[-w, w]，深度为(z / w + 1) / 2
+struct depth_state_t {
+    COMPARE_FUNC func = COMPARE_LEQUAL;
+    bool write = true;
+    bool zero_to_one = false;
+};
+
+// 配合ortho/perspective的reverse_z使用：GEQUAL，zero_to_one，深度缓冲清除为0
+depth_state_t reverse_z_depth_state();
+
+enum STENCIL_OP {
+    STENCIL_OP_KEEP, STENCIL_OP_ZERO, STENCIL_OP_REPLACE, STENCIL_OP_INVERT,
+    STENCIL_OP_INCR, STENCIL_OP_DECR,               // 饱和
+    STENCIL_OP_INCR_WRAP, STENCIL_OP_DECR_WRAP      // 回绕
+};
+
+// 模板测试：(ref & read_mask) func (stencil & read_mask)，通过才继续深度测试。
+// 模板测试失败执行fail_op，深度测试失败执行depth_fail_op，都通过且没有discard时执行pass_op，
+// 写入时只修改write_mask中的位
+struct stencil_state_t {
+    bool enable = false;
+    COMPARE_FUNC func = COMPARE_ALWAYS;
+    uchar ref = 0;
+    uchar read_mask = 0xff;
+    uchar write_mask = 0xff;
+    STENCIL_OP fail_op = STENCIL_OP_KEEP;
+    STENCIL_OP depth_fail_op = STENCIL_OP_KEEP;
+    STENCIL_OP pass_op = STENCIL_OP_KEEP;
 };
 
-void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, shader_t* shader, PRIMITIVE_TYPE type = TRIANGLE);
+enum BLEND_FACTOR {
+    BLEND_ZERO, BLEND_ONE,
+    BLEND_SRC_COLOR, BLEND_ONE_MINUS_SRC_COLOR,
+    BLEND_DST_COLOR, BLEND_ONE_MINUS_DST_COLOR,
+    BLEND_SRC_ALPHA, BLEND_ONE_MINUS_SRC_ALPHA,
+    BLEND_DST_ALPHA, BLEND_ONE_MINUS_DST_ALPHA
+};
+
+// MIN/MAX忽略混合因子
+enum BLEND_OP {
+    BLEND_OP_ADD, BLEND_OP_SUBTRACT, BLEND_OP_REVERSE_SUBTRACT, BLEND_OP_MIN, BLEND_OP_MAX
+};
+
+// 混合：result = src * src_factor op dst * dst_factor，颜色和alpha分别设置，只作用于第0个颜色附件。
+// 关闭或者等价于直接覆盖时不读取已有的颜色。RGBA8用定点数计算（四舍五入），浮点格式不截断
+struct blend_state_t {
+    bool enable = false;
+    BLEND_FACTOR src_color = BLEND_ONE;
+    BLEND_FACTOR dst_color = BLEND_ZERO;
+    BLEND_OP color_op = BLEND_OP_ADD;
+    BLEND_FACTOR src_alpha = BLEND_ONE;
+    BLEND_FACTOR dst_alpha = BLEND_ZERO;
+    BLEND_OP alpha_op = BLEND_OP_ADD;
+};
+
+// 常用的混合状态：透明（SRC_ALPHA, ONE_MINUS_SRC_ALPHA）和叠加（ONE, ONE）
+blend_state_t alpha_blend_state();
+blend_state_t additive_blend_state();
+
+// 一次draw使用的固定功能状态，NULL表示全部使用默认值
+struct render_state_t {
+    depth_state_t depth;
+    stencil_state_t stencil;
+    blend_state_t blend;
+    // fragment插入framebuffer的OIT链表，不写深度、颜色和额外的颜色附件，忽略blend
+    bool oit = false;
+};
+
+// 透明物体需要在不透明物体之后从远到近绘制。centers为各物体在世界空间的中心，
+// order返回按观察空间深度从远到近的绘制顺序（物体的下标），深度相同时保持原来的顺序
+void sort_back_to_front(const mat4& view_matrix, const vec3* centers, int count, int* order);
+
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, shader_t* shader, PRIMITIVE_TYPE type = TRIANGLE,
+                     const render_state_t* state = NULL);
+// 索引绘制：顶点为data->at(indices->at(i))
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, shader_t* shader,
+                     PRIMITIVE_TYPE type = TRIANGLE, const render_state_t* state = NULL);
+
+// 实例化绘制：instances的每个元素是一个实例的属性，vertex阶段调用instance_vertex_shader同时读取顶点和实例的属性。
+// 一次调用画出所有实例，vertex shader和裁剪按实例分给多个线程，光栅化按实例的顺序进行。indices可以为NULL
+void draw_primitives_instanced(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, const vbo_t* instances,
+                               shader_t* shader, PRIMITIVE_TYPE type = TRIANGLE, const render_state_t* state = NULL);
+
+// 只写深度（shadow map、depth prepass）：只运行vertex_shader，不执行fragment_shader也不写颜色，
+// 比draw_primitives快得多。覆盖规则、背面剔除、深度测试和写入的深度值与draw_primitives完全一致，
+// 之后可以用COMPARE_EQUAL、不写深度的draw_primitives只着色可见的像素。只使用state中的depth，不使用模板缓冲
+void draw_depth(framebuffer_t* framebuffer, const vbo_t* data, shader_t* shader, const render_state_t* state = NULL);
+// 索引绘制，type只能是TRIANGLE、TRIANGLE_STRIP或TRIANGLE_FAN
+void draw_depth(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, shader_t* shader,
+                PRIMITIVE_TYPE type = TRIANGLE, const render_state_t* state = NULL);
+
+// 阻止模板参数推导，只有显式写出draw_primitives<Shader>时才会选中模板版本
+template <class T>
+struct type_identity {
+    typedef T type;
+};
+
+// 模板版本：直接调用Shader的非虚函数，vertex/fragment可以内联进光栅化循环。
+// Shader需要定义attribs_t、varyings_t（全部由float组成），以及
+//     const vec4 vertex(const attribs_t& attribs, varyings_t& varyings);
+//     const vec4 fragment(const varyings_t& varyings, bool& discard);
+// 实现在core/pipeline.h中，需要在定义Shader的源文件里显式实例化，例如：
+//     template void draw_primitives<blin_shader_t>(framebuffer_t*, const vbo_t*, blin_shader_t*, PRIMITIVE_TYPE, const render_state_t*);
+//     template void draw_primitives<blin_shader_t>(framebuffer_t*, const vbo_t*, const ibo_t*, blin_shader_t*, PRIMITIVE_TYPE, const render_state_t*);
+// 实例化绘制还需要定义instance_attribs_t和
+//     const vec4 vertex(const attribs_t& attribs, const instance_attribs_t& instance, varyings_t& varyings);
+template <class Shader>
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, typename type_identity<Shader>::type* shader, PRIMITIVE_TYPE type = TRIANGLE,
+                     const render_state_t* state = NULL);
+template <class Shader>
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, typename type_identity<Shader>::type* shader,
+                     PRIMITIVE_TYPE type = TRIANGLE, const render_state_t* state = NULL);
+
+template <class Shader>
+void draw_primitives_instanced(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, const vbo_t* instances,
+                               typename type_identity<Shader>::type* shader, PRIMITIVE_TYPE type = TRIANGLE,
+                               const render_state_t* state = NULL);
 
 #endif  // RASTERIZER_GRAPHIC_H_
\ No newline at end of file
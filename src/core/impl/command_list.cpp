@@ -0,0 +1,83 @@
+#include "core/command_list.h"
+
+#include <algorithm>
+#include <cassert>
+#include <future>
+#include <unordered_map>
+
+#include "core/pipeline.h"
+#include "utils/ThreadPool.h"
+
+command_list_t::command_list_t() {}
+
+command_list_t::~command_list_t() { clear(); }
+
+void command_list_t::record(deferred_draw_t* draw_call, shader_t* shader, const vbo_t* data, const render_state_t* state) {
+    command_t command;
+    command.draw_call = draw_call;
+    command.shader = shader;
+    command.data = data;
+    command.order_independent = render::is_order_independent(state);
+    command.depth_func = state ? state->depth.func : depth_state_t().func;
+    command.shader_key = command.data_key = 0;
+    commands.push_back(command);
+}
+
+int command_list_t::get_num_commands() const { return (int)commands.size(); }
+
+void command_list_t::clear() {
+    for(command_t& command : commands) delete command.draw_call;
+    commands.clear();
+}
+
+// 只在连续的、与顺序无关并且深度比较相同的绘制之间排序，其他绘制和深度比较的变化是分界。
+// 按第一次出现的序号排序，每次submit的顺序只取决于记录的顺序
+void command_list_t::sort_commands() {
+    std::unordered_map<const void*, int> first_use;
+    auto key_of = [&](const void* object) { return first_use.emplace(object, (int)first_use.size()).first->second; };
+    for(command_t& command : commands) {
+        command.shader_key = key_of(command.shader);
+        command.data_key = key_of(command.data);
+    }
+    auto by_state = [](const command_t& a, const command_t& b) {
+        if(a.shader_key != b.shader_key) return a.shader_key < b.shader_key;
+        return a.data_key < b.data_key;
+    };
+    int num = (int)commands.size();
+    for(int begin = 0; begin < num;) {
+        if(!commands[begin].order_independent) {
+            begin++;
+            continue;
+        }
+        int end = begin + 1;
+        while(end < num && commands[end].order_independent && commands[end].depth_func == commands[begin].depth_func) end++;
+        std::stable_sort(commands.begin() + begin, commands.begin() + end, by_state);
+        begin = end;
+    }
+}
+
+void command_list_t::submit(framebuffer_t* framebuffer) {
+    assert(framebuffer);
+    sort_commands();
+    int num = (int)commands.size();
+    bool threaded = ThreadPool::size() > 1;
+    // 当前绘制的vertex阶段是否已经在上一次循环中执行
+    bool processed = false;
+    for(int i = 0; i < num; i++) {
+        // 下一个绘制使用其他的shader对象时，它的vertex阶段与当前绘制同时执行
+        bool overlap = threaded && i + 1 < num && commands[i + 1].shader != commands[i].shader;
+        std::future<void> pending;
+        if(overlap) {
+            deferred_draw_t* next = commands[i + 1].draw_call;
+            pending = ThreadPool::enqueue([next] { next->process_vertices(); });
+        }
+        if(processed) {
+            commands[i].draw_call->rasterize(framebuffer);
+        } else {
+            commands[i].draw_call->execute(framebuffer);
+        }
+        if(overlap) pending.wait();
+        processed = overlap;
+    }
+    clear();
+}
@@ -0,0 +1,279 @@
+#include "core/framewriter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "utils/ThreadPool.h"
+
+namespace {
+/** png **/
+// 用不压缩的deflate块，数据大小可以提前算出，因此可以边读边写只用一个IDAT块
+uint crc_table[256];
+
+void init_crc_table() {
+    for(uint n = 0; n < 256; n++) {
+        uint c = n;
+        for(int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+struct png_stream_t {
+    FILE* file;
+    uint crc;
+    uint adler_a, adler_b;
+    size_t raw_left;    // 剩余的未压缩数据
+    size_t block_left;  // 当前deflate块剩余数据
+
+    void put(const uchar* data, size_t len) {
+        for(size_t i = 0; i < len; i++) {
+            crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        fwrite(data, 1, len, file);
+    }
+
+    void put_u32(uint value) {
+        uchar bytes[4] = {uchar(value >> 24), uchar(value >> 16), uchar(value >> 8), uchar(value)};
+        put(bytes, 4);
+    }
+
+    void begin_chunk(const char* type, uint length) {
+        uchar bytes[4] = {uchar(length >> 24), uchar(length >> 16), uchar(length >> 8), uchar(length)};
+        fwrite(bytes, 1, 4, file);
+        crc = 0xffffffffu;
+        put((const uchar*)type, 4);
+    }
+
+    void end_chunk() {
+        uint value = crc ^ 0xffffffffu;
+        uchar bytes[4] = {uchar(value >> 24), uchar(value >> 16), uchar(value >> 8), uchar(value)};
+        fwrite(bytes, 1, 4, file);
+    }
+
+    void put_raw(const uchar* data, size_t len) {
+        while(len > 0) {
+            if(block_left == 0) {
+                block_left = std::min(raw_left, (size_t)65535);
+                uchar header[5] = {uchar(block_left == raw_left ? 1 : 0),
+                                   uchar(block_left), uchar(block_left >> 8),
+                                   uchar(~block_left), uchar(~block_left >> 8)};
+                put(header, 5);
+            }
+            size_t n = std::min(len, block_left);
+            for(size_t i = 0; i < n; i++) {
+                adler_a = (adler_a + data[i]) % 65521;
+                adler_b = (adler_b + adler_a) % 65521;
+            }
+            put(data, n);
+            data += n;
+            len -= n;
+            raw_left -= n;
+            block_left -= n;
+        }
+    }
+};
+
+bool write_png(FILE* file, const framebuffer_t* framebuffer) {
+    static std::once_flag crc_once;
+    std::call_once(crc_once, init_crc_table);
+
+    int width = framebuffer->get_width(), height = framebuffer->get_height();
+    size_t row_size = 1 + (size_t)width * 4;
+    size_t raw_size = row_size * height;
+    size_t num_blocks = (raw_size + 65534) / 65535;
+    size_t zlib_size = 2 + raw_size + 5 * num_blocks + 4;
+    if(zlib_size > 0x7fffffffu) return false;
+
+    png_stream_t png;
+    png.file = file;
+    png.adler_a = 1;
+    png.adler_b = 0;
+    png.raw_left = raw_size;
+    png.block_left = 0;
+
+    const uchar signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    png.begin_chunk("IHDR", 13);
+    png.put_u32(width);
+    png.put_u32(height);
+    const uchar ihdr[5] = {8, 6, 0, 0, 0};  // 8bit RGBA
+    png.put(ihdr, 5);
+    png.end_chunk();
+
+    png.begin_chunk("IDAT", zlib_size);
+    const uchar zlib_header[2] = {0x78, 0x01};
+    png.put(zlib_header, 2);
+    const uchar filter = 0;
+    const uchar* color = framebuffer->get_color_data();
+    for(int y = 0; y < height; y++) {
+        png.put_raw(&filter, 1);
+        png.put_raw(color + (size_t)y * width * 4, (size_t)width * 4);
+    }
+    png.put_u32((png.adler_b << 16) | png.adler_a);
+    png.end_chunk();
+
+    png.begin_chunk("IEND", 0);
+    png.end_chunk();
+    return true;
+}
+
+/** ppm **/
+bool write_ppm(FILE* file, const framebuffer_t* framebuffer) {
+    int width = framebuffer->get_width(), height = framebuffer->get_height();
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<uchar> row(width * 3);
+    const uchar* color = framebuffer->get_color_data();
+    for(int y = 0; y < height; y++) {
+        const uchar* src = color + (size_t)y * width * 4;
+        for(int x = 0; x < width; x++) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    return true;
+}
+
+/** exr **/
+// 不压缩的单部件scanline文件，每行一个块，偏移表可以提前算出。只支持小端机器
+void put_attribute(std::vector<char>& header, const char* name, const char* type,
+                   const void* value, int size) {
+    header.insert(header.end(), name, name + strlen(name) + 1);
+    header.insert(header.end(), type, type + strlen(type) + 1);
+    header.insert(header.end(), (const char*)&size, (const char*)&size + 4);
+    header.insert(header.end(), (const char*)value, (const char*)value + size);
+}
+
+bool write_exr(FILE* file, const framebuffer_t* framebuffer, bool with_depth) {
+    int width = framebuffer->get_width(), height = framebuffer->get_height();
+    // 通道必须按名字排序
+    const char* channels[5] = {"A", "B", "G", "R", "Z"};
+    const int color_offset[4] = {3, 2, 1, 0};
+    int num_channels = with_depth ? 5 : 4;
+
+    std::vector<char> chlist;
+    for(int i = 0; i < num_channels; i++) {
+        int channel[4] = {2, 0, 1, 1};  // FLOAT, pLinear + reserved, xSampling, ySampling
+        chlist.insert(chlist.end(), channels[i], channels[i] + strlen(channels[i]) + 1);
+        chlist.insert(chlist.end(), (const char*)channel, (const char*)channel + 16);
+    }
+    chlist.push_back(0);
+
+    std::vector<char> header = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+    int window[4] = {0, 0, width - 1, height - 1};
+    char zero = 0;
+    float one = 1.0f, center[2] = {0.0f, 0.0f};
+    put_attribute(header, "channels", "chlist", chlist.data(), chlist.size());
+    put_attribute(header, "compression", "compression", &zero, 1);
+    put_attribute(header, "dataWindow", "box2i", window, 16);
+    put_attribute(header, "displayWindow", "box2i", window, 16);
+    put_attribute(header, "lineOrder", "lineOrder", &zero, 1);
+    put_attribute(header, "pixelAspectRatio", "float", &one, 4);
+    put_attribute(header, "screenWindowCenter", "v2f", center, 8);
+    put_attribute(header, "screenWindowWidth", "float", &one, 4);
+    header.push_back(0);
+    fwrite(header.data(), 1, header.size(), file);
+
+    int block_size = 8 + width * num_channels * 4;
+    unsigned long long offset = header.size() + 8ull * height;
+    for(int y = 0; y < height; y++, offset += block_size) {
+        fwrite(&offset, 8, 1, file);
+    }
+
+    // 单采样的HDR格式直接写入浮点颜色，其余使用resolve后的RGBA8。
+    // EXR中的颜色是线性的，RGBA8中的RGB是sRGB编码的，需要先转回线性，alpha本来就是线性的
+    bool hdr = framebuffer->get_color_format() != COLOR_FORMAT_RGBA8 && framebuffer->get_num_samples() == 1;
+    float srgb_to_linear[256], unorm_to_float[256];
+    for(int k = 0; k < 256; k++) {
+        unorm_to_float[k] = k / 255.0f;
+        srgb_to_linear[k] = float_srgb2linear(unorm_to_float[k]);
+    }
+    bool float_depth = framebuffer->get_depth_format() == DEPTH_FORMAT_D32F;
+    std::vector<float> row(width * num_channels);
+    const uchar* color = framebuffer->get_color_data();
+    const float* depth = with_depth && float_depth ? framebuffer->get_color_depth() : NULL;
+    for(int y = 0; y < height; y++) {
+        // 第0行是屏幕最上方
+        int screen_y = height - y - 1;
+        const uchar* src = color + (size_t)y * width * 4;
+        for(int c = 0; c < 4; c++) {
+            float* dst = row.data() + c * width;
+            const float* decode = color_offset[c] == 3 ? unorm_to_float : srgb_to_linear;
+            for(int x = 0; x < width; x++) {
+                dst[x] = hdr ? framebuffer->get_sample_color(x, screen_y, 0).data()[color_offset[c]]
+                             : decode[src[x * 4 + color_offset[c]]];
+            }
+        }
+        if(with_depth && float_depth) {
+            memcpy(row.data() + 4 * width, depth + (size_t)y * width, width * sizeof(float));
+        } else if(with_depth) {
+            for(int x = 0; x < width; x++) {
+                row[4 * width + x] = framebuffer->get_depth(x, screen_y);
+            }
+        }
+        int data_size = width * num_channels * 4;
+        fwrite(&y, 4, 1, file);
+        fwrite(&data_size, 4, 1, file);
+        fwrite(row.data(), 1, data_size, file);
+    }
+    return true;
+}
+
+bool write_frame(const framebuffer_t* framebuffer, const std::string filename,
+                 frame_format_t format, bool with_depth) {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if(!file) return false;
+    bool succeed = false;
+    switch(format) {
+        case FRAME_FORMAT_PPM:
+            succeed = write_ppm(file, framebuffer);
+            break;
+        case FRAME_FORMAT_PNG:
+            succeed = write_png(file, framebuffer);
+            break;
+        case FRAME_FORMAT_EXR:
+            succeed = write_exr(file, framebuffer, with_depth);
+            break;
+    }
+    succeed &= !ferror(file);
+    succeed &= fclose(file) == 0;
+    return succeed;
+}
+}  // namespace
+
+frame_writer_t::frame_writer_t() : target(NULL) {}
+
+frame_writer_t::~frame_writer_t() { wait(); }
+
+void frame_writer_t::write(framebuffer_t* framebuffer, const std::string& filename,
+                           frame_format_t format, bool with_depth) {
+    assert(framebuffer);
+    wait();
+    framebuffer->materialize_color();
+    if(with_depth) framebuffer->materialize_depth();
+    target = framebuffer;
+    pending = ThreadPool::enqueue(write_frame, framebuffer, filename, format, with_depth);
+}
+
+bool frame_writer_t::wait() {
+    if(!pending.valid()) return true;
+    return pending.get();
+}
+
+bool frame_writer_t::is_busy() {
+    if(!pending.valid()) return false;
+    return pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+bool frame_writer_t::is_reading(const framebuffer_t* framebuffer) {
+    return framebuffer == target && is_busy();
+}
@@ -1,18 +1,31 @@
 #include "core/graphics.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <vector>
 
+#include "core/pipeline.h"
+#include "utils/ThreadPool.h"
+
 
 vbo_t::vbo_t(int _sizeof_element, int _count)
-    : sizeof_element(_sizeof_element), count(_count), raw_data(NULL) {
+    : sizeof_element(_sizeof_element), count(_count), raw_data(NULL), owns_data(true) {
     raw_data = new char[_sizeof_element * _count];
 }
 
-vbo_t::~vbo_t() { delete[] raw_data; }
+vbo_t::vbo_t(int _sizeof_element, int _count, const void* _external_data)
+    : sizeof_element(_sizeof_element),
+      count(_count),
+      raw_data((char*)_external_data),
+      owns_data(false) {}
+
+vbo_t::~vbo_t() {
+    if(owns_data) delete[] raw_data;
+}
 
 void* vbo_t::data() { return raw_data; }
 
@@ -34,388 +47,719 @@ int vbo_t::get_count() const { return count; }
 
 int vbo_t::get_totol_size() const { return get_count() * get_sizeof_element(); }
 
-framebuffer_t::framebuffer_t(int _width, int _height)
-    : width(_width), height(_height), color_buffer(NULL), depth_buffer(NULL) {
-    color_buffer = new uchar[width * height * 4];
-    depth_buffer = new float[width * height];
+ibo_t::ibo_t(int _count) : count(_count), indices(new uint[_count]) {}
+
+ibo_t::~ibo_t() { delete[] indices; }
+
+uint* ibo_t::data() { return indices; }
+
+const uint* ibo_t::data() const { return indices; }
+
+uint& ibo_t::at(int p) {
+    assert(p >= 0 && p < count);
+    return indices[p];
+}
+
+uint ibo_t::at(int p) const {
+    assert(p >= 0 && p < count);
+    return indices[p];
+}
+
+int ibo_t::get_count() const { return count; }
+
+namespace {
+// 延迟清除以16x16像素为一个tile记录状态
+const int tile_shift = 4;
+const int tile_size = 1 << tile_shift;
+
+enum {
+    TILE_COLOR = 1,     // 颜色（多重采样时为各采样点的颜色）还没有写入清除值
+    TILE_DEPTH = 2,     // 深度还没有写入清除值
+    TILE_RESOLVED = 4   // 需要resolve时，resolve后的颜色还没有写入清除值
+};
+
+// 用一个像素的值（size字节）填充count个像素。每个字节都相同时用memset，否则用std::fill_n，
+// 两者都会被编译成宽的store
+void fill_pixels(uchar* dst, const uchar* value, int size, size_t count) {
+    bool same = true;
+    for(int i = 1; i < size; i++) same &= value[i] == value[0];
+    if(same) {
+        memset(dst, value[0], count * size);
+        return ;
+    }
+    switch(size) {
+        case 2: {
+            ushort v;
+            memcpy(&v, value, sizeof(v));
+            std::fill_n((ushort*)dst, count, v);
+            break;
+        }
+        case 4: {
+            uint v;
+            memcpy(&v, value, sizeof(v));
+            std::fill_n((uint*)dst, count, v);
+            break;
+        }
+        case 8: {
+            unsigned long long v;
+            memcpy(&v, value, sizeof(v));
+            std::fill_n((unsigned long long*)dst, count, v);
+            break;
+        }
+        default: {
+            struct pixel16_t { unsigned long long lo, hi; } v;
+            memcpy(&v, value, sizeof(v));
+            std::fill_n((pixel16_t*)dst, count, v);
+            break;
+        }
+    }
+}
+
+// 把count个HDR格式的像素转换为RGBA8，与rgba2rgbapack的结果相同。
+// 半精度用查表，单精度的循环可以向量化
+void convert_to_rgba8(COLOR_FORMAT format, const uchar* src, uchar* dst, size_t count) {
+    if(format == COLOR_FORMAT_RGBA16F) {
+        static const std::vector<uchar> table = []() {
+            std::vector<uchar> table(65536);
+            for(int i = 0; i < 65536; i++) {
+                table[i] = static_cast<uint>(255 * clamp(half2float(i), 0.0f, 1.0f));
+            }
+            return table;
+        }();
+        const ushort* h = (const ushort*)src;
+        for(size_t i = 0; i < count * 4; i++) dst[i] = table[h[i]];
+    } else {
+        const float* f = (const float*)src;
+        for(size_t i = 0; i < count * 4; i++) dst[i] = static_cast<uint>(255 * clamp(f[i], 0.0f, 1.0f));
+    }
+}
+}  // namespace
+
+int get_color_format_size(COLOR_FORMAT format) {
+    switch(format) {
+        case COLOR_FORMAT_RGBA16F: return 8;
+        case COLOR_FORMAT_RGBA32F: return 16;
+        default: return 4;
+    }
+}
+
+int get_depth_format_size(DEPTH_FORMAT format) {
+    return format == DEPTH_FORMAT_D16 ? 2 : 4;
+}
+
+framebuffer_t::framebuffer_t(int _width, int _height, int _num_samples,
+                             COLOR_FORMAT _color_format, DEPTH_FORMAT _depth_format, bool _has_stencil)
+    : width(_width),
+      height(_height),
+      num_samples(_num_samples),
+      color_format(_color_format),
+      depth_format(_depth_format),
+      color_size(get_color_format_size(_color_format)),
+      depth_size(get_depth_format_size(_depth_format)),
+      color_buffer(NULL),
+      color_target(NULL),
+      depth_buffer(NULL),
+      stencil_buffer(NULL),
+      num_attachments(1),
+      tiles_x((_width + tile_size - 1) >> tile_shift),
+      tiles_y((_height + tile_size - 1) >> tile_shift),
+      tile_state(NULL),
+      pending_flags(0),
+      fast_clear_resolved(0),
+      oit_heads(NULL),
+      oit_nodes(NULL),
+      oit_capacity(0) {
+    assert(num_samples == 1 || num_samples == 2 || num_samples == 4);
+    size_t size = (size_t)width * height;
+    color_buffer = new uchar[size * 4];
+    if(num_samples == 1 && color_format == COLOR_FORMAT_RGBA8) {
+        color_target = color_buffer;
+    } else {
+        color_target = new uchar[size * num_samples * color_size];
+    }
+    depth_buffer = new uchar[size * num_samples * depth_size];
+    if(_has_stencil) stencil_buffer = new uchar[size * num_samples];
+    tile_state = new uchar[tiles_x * tiles_y];
+    memset(tile_state, 0, tiles_x * tiles_y);
+    memset(fast_clear_color, 0, sizeof(fast_clear_color));
+    memset(fast_clear_depth, 0, sizeof(fast_clear_depth));
+    attachment_formats[0] = color_format;
+    attachments[0] = color_target;
 }
 
 framebuffer_t::~framebuffer_t() {
+    if(color_target != color_buffer) delete[] color_target;
     delete[] color_buffer;
     delete[] depth_buffer;
+    delete[] stencil_buffer;
+    delete[] tile_state;
+    for(int i = 1; i < num_attachments; i++) delete[] attachments[i];
+    delete[] oit_heads;
+    delete[] oit_nodes;
 }
 
 int framebuffer_t::get_width() const { return width; }
 int framebuffer_t::get_height() const { return height; }
+int framebuffer_t::get_num_samples() const { return num_samples; }
+COLOR_FORMAT framebuffer_t::get_color_format() const { return color_format; }
+DEPTH_FORMAT framebuffer_t::get_depth_format() const { return depth_format; }
+bool framebuffer_t::has_stencil() const { return stencil_buffer != NULL; }
+
+bool framebuffer_t::needs_resolve() const { return color_target != color_buffer; }
 
 void framebuffer_t::clear_color(vec4 color) {
-    for(int i = 0; i < width * height; i++) {
-        ((uint*)color_buffer)[i] = rgba2rgbapack(color);
+    uchar value[16];
+    render::encode_color(color_format, color, value);
+    size_t size = (size_t)width * height;
+    fill_pixels(color_target, value, color_size, size * num_samples);
+    if(needs_resolve()) {
+        uint pack = rgba2rgbapack(color);
+        fill_pixels(color_buffer, (const uchar*)&pack, 4, size);
     }
+    for(int i = 0; i < tiles_x * tiles_y; i++) {
+        tile_state[i] &= ~(TILE_COLOR | TILE_RESOLVED);
+    }
+    pending_flags &= ~(TILE_COLOR | TILE_RESOLVED);
 }
 
 void framebuffer_t::clear_depth(float depth) {
-    for(int i = 0; i < width * height; i++) {
-        depth_buffer[i] = depth;
+    uchar value[4];
+    render::store_depth(depth_format, value, 0, depth);
+    fill_pixels(depth_buffer, value, depth_size, (size_t)width * height * num_samples);
+    for(int i = 0; i < tiles_x * tiles_y; i++) {
+        tile_state[i] &= ~TILE_DEPTH;
+    }
+    pending_flags &= ~TILE_DEPTH;
+}
+
+void framebuffer_t::clear_stencil(uchar stencil) {
+    assert(stencil_buffer);
+    memset(stencil_buffer, stencil, (size_t)width * height * num_samples);
+}
+
+void framebuffer_t::fast_clear_color_buffer(vec4 color) {
+    render::encode_color(color_format, color, fast_clear_color);
+    fast_clear_resolved = rgba2rgbapack(color);
+    int flags = needs_resolve() ? (TILE_COLOR | TILE_RESOLVED) : TILE_COLOR;
+    for(int i = 0; i < tiles_x * tiles_y; i++) {
+        tile_state[i] |= flags;
+    }
+    pending_flags |= flags;
+}
+
+void framebuffer_t::fast_clear_depth_buffer(float depth) {
+    render::store_depth(depth_format, fast_clear_depth, 0, depth);
+    for(int i = 0; i < tiles_x * tiles_y; i++) {
+        tile_state[i] |= TILE_DEPTH;
+    }
+    pending_flags |= TILE_DEPTH;
+}
+
+// 把tile中flags对应的部分写成清除值
+void framebuffer_t::materialize_tile(int tile, int flags) {
+    int pending = tile_state[tile] & flags;
+    if(!pending) return ;
+    int x0 = (tile % tiles_x) << tile_shift, x1 = std::min(x0 + tile_size, width);
+    int r0 = (tile / tiles_x) << tile_shift, r1 = std::min(r0 + tile_size, height);
+    size_t size = (size_t)width * height;
+    for(int r = r0; r < r1; r++) {
+        size_t p = (size_t)r * width + x0;
+        for(int s = 0; s < num_samples; s++) {
+            if(pending & TILE_COLOR) {
+                fill_pixels(color_target + (s * size + p) * color_size, fast_clear_color, color_size, x1 - x0);
+            }
+            if(pending & TILE_DEPTH) {
+                fill_pixels(depth_buffer + (s * size + p) * depth_size, fast_clear_depth, depth_size, x1 - x0);
+            }
+        }
+        if(pending & TILE_RESOLVED) {
+            fill_pixels(color_buffer + p * 4, (const uchar*)&fast_clear_resolved, 4, x1 - x0);
+        }
+    }
+    tile_state[tile] &= ~pending;
+}
+
+void framebuffer_t::materialize_all(int flags) {
+    if(!(pending_flags & flags)) return ;
+    pending_flags &= ~flags;
+    for(int i = 0; i < tiles_x * tiles_y; i++) {
+        if(tile_state[i] & flags) materialize_tile(i, flags);
     }
 }
 
 float framebuffer_t::get_depth(int x, int y) const {
-    assert(x >= 0 && x < width && y >= 0 && y < height);
-    int p = (height - y - 1) * width + x;
-    return depth_buffer[p];
+    return get_sample_depth(x, y, 0);
 }
 
 const vec4 framebuffer_t::get_color(int x, int y) const {
     assert(x >= 0 && x < width && y >= 0 && y < height);
-    int p = ((height - y - 1) * width + x) * 4;
+    int row = height - y - 1;
+    int tile = (row >> tile_shift) * tiles_x + (x >> tile_shift);
+    if(tile_state[tile] & (needs_resolve() ? TILE_RESOLVED : TILE_COLOR)) {
+        return rgbapack2rgba((const uchar*)&fast_clear_resolved);
+    }
+    size_t p = ((size_t)row * width + x) * 4;
     return rgbapack2rgba(color_buffer + p);
 }
 
 void framebuffer_t::set_depth(int x, int y, float depth) {
-    assert(x >= 0 && x < width && y >= 0 && y < height);
-    int p = (height - y - 1) * width + x;
-    depth_buffer[p] = depth;
+    for(int s = 0; s < num_samples; s++) {
+        set_sample_depth(x, y, s, depth);
+    }
 }
 
 void framebuffer_t::set_color(int x, int y, vec4 color) {
-    if(!(x >= 0 && x < width && y >= 0 && y < height)) {
-        printf("%d %d\n", x, y);
-    }
     assert(x >= 0 && x < width && y >= 0 && y < height);
-    int p = (height - y - 1) * width + x;
-    ((uint*)color_buffer)[p] = rgba2rgbapack(color);
+    int row = height - y - 1;
+    int tile = (row >> tile_shift) * tiles_x + (x >> tile_shift);
+    if(tile_state[tile]) materialize_tile(tile, TILE_COLOR | TILE_RESOLVED);
+    size_t p = (size_t)row * width + x;
+    uchar value[16];
+    render::encode_color(color_format, color, value);
+    for(int s = 0; s < num_samples; s++) {
+        memcpy(color_target + (s * (size_t)width * height + p) * color_size, value, color_size);
+    }
+    if(needs_resolve()) {
+        ((uint*)color_buffer)[p] = rgba2rgbapack(color);
+    }
+}
+
+float framebuffer_t::get_sample_depth(int x, int y, int sample) const {
+    assert(x >= 0 && x < width && y >= 0 && y < height && sample >= 0 && sample < num_samples);
+    int row = height - y - 1;
+    int tile = (row >> tile_shift) * tiles_x + (x >> tile_shift);
+    if(tile_state[tile] & TILE_DEPTH) return render::load_depth(depth_format, fast_clear_depth, 0);
+    size_t p = sample * (size_t)width * height + (size_t)row * width;
+    return render::load_depth(depth_format, depth_buffer + p * depth_size, x);
 }
 
-const uchar* framebuffer_t::get_color_data() const { return color_buffer; }
+const vec4 framebuffer_t::get_sample_color(int x, int y, int sample) const {
+    assert(x >= 0 && x < width && y >= 0 && y < height && sample >= 0 && sample < num_samples);
+    int row = height - y - 1;
+    int tile = (row >> tile_shift) * tiles_x + (x >> tile_shift);
+    if(tile_state[tile] & TILE_COLOR) return render::decode_color(color_format, fast_clear_color);
+    size_t p = sample * (size_t)width * height + (size_t)row * width + x;
+    return render::decode_color(color_format, color_target + p * color_size);
+}
 
-const float* framebuffer_t::get_color_depth() const { return depth_buffer; }
+void framebuffer_t::set_sample_depth(int x, int y, int sample, float depth) {
+    assert(x >= 0 && x < width && y >= 0 && y < height && sample >= 0 && sample < num_samples);
+    int row = height - y - 1;
+    int tile = (row >> tile_shift) * tiles_x + (x >> tile_shift);
+    if(tile_state[tile] & TILE_DEPTH) materialize_tile(tile, TILE_DEPTH);
+    size_t p = sample * (size_t)width * height + (size_t)row * width;
+    render::store_depth(depth_format, depth_buffer + p * depth_size, x, depth);
+}
 
-namespace {
-const int max_num_of_v2fs = 20;
-namespace render {
-struct v2f_t {
-    v2f_t(int _sizeof_varing) {
-        data = new char[_sizeof_varing];
-        sizeof_varying = _sizeof_varing;
+void framebuffer_t::set_sample_color(int x, int y, int sample, vec4 color) {
+    assert(x >= 0 && x < width && y >= 0 && y < height && sample >= 0 && sample < num_samples);
+    int row = height - y - 1;
+    int tile = (row >> tile_shift) * tiles_x + (x >> tile_shift);
+    if(tile_state[tile] & TILE_COLOR) materialize_tile(tile, TILE_COLOR);
+    size_t p = sample * (size_t)width * height + (size_t)row * width + x;
+    render::encode_color(color_format, color, color_target + p * color_size);
+}
+
+uchar framebuffer_t::get_stencil(int x, int y, int sample) const {
+    assert(stencil_buffer && x >= 0 && x < width && y >= 0 && y < height && sample >= 0 && sample < num_samples);
+    return stencil_buffer[sample * (size_t)width * height + (size_t)(height - y - 1) * width + x];
+}
+
+void framebuffer_t::set_stencil(int x, int y, uchar stencil) {
+    assert(stencil_buffer && x >= 0 && x < width && y >= 0 && y < height);
+    size_t p = (size_t)(height - y - 1) * width + x;
+    for(int s = 0; s < num_samples; s++) {
+        stencil_buffer[s * (size_t)width * height + p] = stencil;
     }
-    ~v2f_t() { delete[] data; }
-    v2f_t(const v2f_t&) = delete;
-    v2f_t& operator=(const v2f_t&) = delete;
+}
 
-    vec4 position;
-    int sizeof_varying;
-    char* data;
-};
+int framebuffer_t::add_color_attachment(COLOR_FORMAT format) {
+    assert(num_attachments < max_num_of_outputs);
+    size_t size = (size_t)width * height * num_samples * get_color_format_size(format);
+    attachment_formats[num_attachments] = format;
+    attachments[num_attachments] = new uchar[size];
+    memset(attachments[num_attachments], 0, size);
+    return num_attachments++;
+}
 
-struct bbox_t {
-    int xl, xr;
-    int yl, yr;
-};
+int framebuffer_t::get_num_color_attachments() const { return num_attachments; }
 
-void lerp_v2f(const v2f_t* a, const v2f_t* b, float t, v2f_t* target) {
-    target->position = a->position + (b->position - a->position) * t;
-    int count = (a->sizeof_varying) >> 2;
-    float* data_a = (float*)a->data;
-    float* data_b = (float*)b->data;
-    float* data_c = (float*)target->data;
-    for(int i = 0; i < count; i++) {
-        data_c[i] = data_a[i] + (data_b[i] - data_a[i]) * t;
+COLOR_FORMAT framebuffer_t::get_attachment_format(int index) const {
+    assert(index >= 0 && index < num_attachments);
+    return attachment_formats[index];
+}
+
+void framebuffer_t::clear_attachment(int index, vec4 value) {
+    assert(index >= 0 && index < num_attachments);
+    if(index == 0) {
+        clear_color(value);
+        return ;
     }
+    uchar encoded[16];
+    render::encode_color(attachment_formats[index], value, encoded);
+    fill_pixels(attachments[index], encoded, get_color_format_size(attachment_formats[index]),
+                (size_t)width * height * num_samples);
 }
 
-void interpolation_v2f(const v2f_t* a, const v2f_t* b, const v2f_t* c, vec3 uvw, v2f_t* target) {
-    float weight = 1.0 / (uvw.x() + uvw.y() + uvw.z());
-    target->position = (a->position * uvw.x() + b->position * uvw.y() + c->position * uvw.z()) * weight;
+const vec4 framebuffer_t::get_attachment_color(int index, int x, int y, int sample) const {
+    assert(index >= 0 && index < num_attachments);
+    if(index == 0) return get_sample_color(x, y, sample);
+    assert(x >= 0 && x < width && y >= 0 && y < height && sample >= 0 && sample < num_samples);
+    size_t p = sample * (size_t)width * height + (size_t)(height - y - 1) * width + x;
+    COLOR_FORMAT format = attachment_formats[index];
+    return render::decode_color(format, attachments[index] + p * get_color_format_size(format));
+}
 
-    float* v  = (float*)target->data;
-    float* va = (float*)a->data;
-    float* vb = (float*)b->data;
-    float* vc = (float*)c->data;
-    int count = (a->sizeof_varying) >> 2;
-    for(int i = 0; i < count; i++) {
-        v[i] = (uvw.x() * va[i] + uvw.y() * vb[i] + uvw.z() * vc[i]) * weight;
+void* framebuffer_t::get_attachment_row(int index, int y, int sample) {
+    if(index == 0) return get_color_row(y, 0, width - 1, sample);
+    size_t p = sample * (size_t)width * height + (size_t)(height - y - 1) * width;
+    return attachments[index] + p * get_color_format_size(attachment_formats[index]);
+}
+
+void framebuffer_t::enable_oit(int max_fragments) {
+    assert(max_fragments >= 0);
+    size_t size = (size_t)width * height;
+    if(!oit_heads) {
+        oit_heads = new int[size];
+        std::fill_n(oit_heads, size, -1);
     }
+    // 已有的fragment会被丢弃
+    clear_oit();
+    delete[] oit_nodes;
+    oit_nodes = new oit_node_t[max_fragments];
+    oit_capacity = max_fragments;
 }
 
-int clip_aganst_panels(v2f_t* v2fs[], int indexes[]) {
-    const static vec4 planes[6]{
-        vec4(0, 0, 1, 1),   // near
-        vec4(0, 0, -1, 1),  // far
-        vec4(1, 0, 0, 1),   // left
-        vec4(-1, 0, 0, 1),  // right
-        vec4(0, 1, 0, 1),   // top
-        vec4(0, -1, 0, 1)   // bottom
-    };
-    int cur = 0;
-    std::vector<int> input, output;
-    for(int i = 0; i < 3; i++) {
-        input.push_back(cur++);
+void framebuffer_t::insert_oit_fragment(int x, int y, float depth, const vec4& color, int coverage) {
+    if(oit_pending.num_fragments >= oit_capacity) {
+        oit_pending.num_overflows++;
+        return ;
     }
-    for(int i = 0; !input.empty() && i < 6; i++) {
-        const vec4& C = planes[i];
-        int p = 0, s = input.size() - 1;
-
-        for(; p < input.size(); s = p++) {
-            int pp = input[p], sp = input[s];
-
-            float d1 = v2fs[pp]->position.dot(C);
-            float d2 = v2fs[sp]->position.dot(C);
-            int situation = ((d1 >= 0) | ((d2 >= 0) << 1));
-
-            if(situation == 0) {
-                // do nothing
-            } else if(situation == 1) {
-                if(fabs(d1 - d2) > EPSILON) {
-                    lerp_v2f(v2fs[pp], v2fs[sp], d1 / (d1 - d2), v2fs[cur]);
-                    output.push_back(cur);
-                    cur++;
+    int row = height - y - 1;
+    // resolve_oit直接混合到颜色缓冲上，先写好延迟清除的tile，resolve_oit中各行就不会同时修改tile的状态
+    materialize_span(row, x, x, TILE_COLOR);
+    int index = oit_pending.num_fragments++;
+    int& head = oit_heads[(size_t)row * width + x];
+    oit_node_t& node = oit_nodes[index];
+    node.color = color;
+    node.depth = depth;
+    node.coverage = coverage;
+    node.next = head;
+    head = index;
+}
+
+void framebuffer_t::resolve_oit() {
+    if(!oit_pending.num_fragments) {
+        clear_oit();
+        return ;
+    }
+    size_t size = (size_t)width * height;
+    std::vector<int> row_length(height, 0);
+    parallel_rows(height, [&](int begin, int end) {
+        std::vector<const oit_node_t*> list;
+        std::vector<uint> packed;
+        for(int row = begin; row < end; row++) {
+            for(int x = 0; x < width; x++) {
+                size_t p = (size_t)row * width + x;
+                if(oit_heads[p] < 0) continue;
+                // 表头是最后插入的，倒着放回插入顺序；每个像素的fragment很少，用插入排序（稳定），
+                // 深度相同时先画的在下面
+                list.clear();
+                for(int n = oit_heads[p]; n >= 0; n = oit_nodes[n].next) list.push_back(&oit_nodes[n]);
+                oit_heads[p] = -1;
+                int count = list.size();
+                row_length[row] = std::max(row_length[row], count);
+                std::reverse(list.begin(), list.end());
+                for(int i = 1; i < count; i++) {
+                    const oit_node_t* node = list[i];
+                    int j = i;
+                    for(; j > 0 && list[j - 1]->depth < node->depth; j--) list[j] = list[j - 1];
+                    list[j] = node;
+                }
+                if(color_format == COLOR_FORMAT_RGBA8) {
+                    packed.resize(count);
+                    for(int i = 0; i < count; i++) packed[i] = rgba2rgbapack(list[i]->color);
                 }
-                output.push_back(pp);
-            } else if(situation == 2) {
-                if(fabs(d1 - d2) > EPSILON) {
-                    lerp_v2f(v2fs[pp], v2fs[sp], d1 / (d1 - d2), v2fs[cur]);
-                    output.push_back(cur);
-                    cur++;
+                for(int s = 0; s < num_samples; s++) {
+                    uchar* dst = color_target + (s * size + p) * color_size;
+                    if(color_format == COLOR_FORMAT_RGBA8) {
+                        uint pixel;
+                        memcpy(&pixel, dst, 4);
+                        for(int i = 0; i < count; i++) {
+                            if(list[i]->coverage >> s & 1) pixel = render::blend_rgba8_alpha(packed[i], pixel);
+                        }
+                        memcpy(dst, &pixel, 4);
+                    } else {
+                        vec4 color = render::decode_color(color_format, dst);
+                        for(int i = 0; i < count; i++) {
+                            // 与alpha_blend_state()的blend_color相同
+                            const vec4& src = list[i]->color;
+                            if(list[i]->coverage >> s & 1) color = src * src.a() + color * (1.0f - src.a());
+                        }
+                        uint value[4];
+                        render::encode_color(color_format, color, value);
+                        render::store_color(dst, value, color_size);
+                    }
                 }
-            } else if(situation == 3) {
-                output.push_back(pp);
             }
         }
-        input.swap(output);
-        output.clear();
+    });
+    oit_pending.max_list_length = *std::max_element(row_length.begin(), row_length.end());
+    oit_stats = oit_pending;
+    oit_pending = oit_stats_t();
+}
+
+void framebuffer_t::clear_oit() {
+    if(oit_pending.num_fragments) std::fill_n(oit_heads, (size_t)width * height, -1);
+    oit_stats = oit_pending;
+    oit_pending = oit_stats_t();
+}
+
+oit_stats_t framebuffer_t::get_oit_stats() const { return oit_stats; }
+
+void framebuffer_t::resolve() {
+    if(!needs_resolve()) return ;
+    size_t size = (size_t)width * height;
+    const uint* samples = (const uint*)color_target;
+    for(int tile = 0; tile < tiles_x * tiles_y; tile++) {
+        // 没有画过的tile直接填清除色，采样点保持延迟清除的状态
+        if(tile_state[tile] & TILE_COLOR) {
+            tile_state[tile] |= TILE_RESOLVED;
+            materialize_tile(tile, TILE_RESOLVED);
+            continue;
+        }
+        tile_state[tile] &= ~TILE_RESOLVED;
+        int x0 = (tile % tiles_x) << tile_shift, x1 = std::min(x0 + tile_size, width);
+        int r0 = (tile / tiles_x) << tile_shift, r1 = std::min(r0 + tile_size, height);
+        for(int r = r0; r < r1; r++) {
+            if(color_format != COLOR_FORMAT_RGBA8 && num_samples == 1) {
+                size_t p = (size_t)r * width + x0;
+                convert_to_rgba8(color_format, color_target + p * color_size, color_buffer + p * 4, x1 - x0);
+                continue;
+            }
+            for(size_t i = (size_t)r * width + x0; i < (size_t)r * width + x1; i++) {
+                if(color_format != COLOR_FORMAT_RGBA8) {
+                    const uchar* first = color_target + i * color_size;
+                    bool same = true;
+                    for(int s = 1; s < num_samples; s++) {
+                        const uchar* other = color_target + (s * size + i) * color_size;
+                        for(int k = 0; k < color_size; k += 8) {
+                            unsigned long long a, b;
+                            memcpy(&a, first + k, 8);
+                            memcpy(&b, other + k, 8);
+                            same &= a == b;
+                        }
+                    }
+                    if(same) {
+                        convert_to_rgba8(color_format, first, color_buffer + i * 4, 1);
+                        continue;
+                    }
+                    // HDR格式先在浮点下平均，再截断为RGBA8
+                    vec4 sum(0.0f);
+                    for(int s = 0; s < num_samples; s++) {
+                        sum = sum + render::decode_color(color_format, color_target + (s * size + i) * color_size);
+                    }
+                    ((uint*)color_buffer)[i] = rgba2rgbapack(sum * (1.0f / num_samples));
+                    continue;
+                }
+                uint first = samples[i];
+                // 三角形内部的像素所有采样点颜色相同，直接拷贝
+                bool same = true;
+                for(int s = 1; s < num_samples; s++) {
+                    same &= samples[s * size + i] == first;
+                }
+                if(same) {
+                    ((uint*)color_buffer)[i] = first;
+                    continue;
+                }
+                // 逐通道取平均
+                uint sum[4] = {0, 0, 0, 0};
+                for(int s = 0; s < num_samples; s++) {
+                    uint c = samples[s * size + i];
+                    for(int k = 0; k < 4; k++) {
+                        sum[k] += (c >> (k * 8)) & 0xff;
+                    }
+                }
+                uint result = 0;
+                for(int k = 0; k < 4; k++) {
+                    result |= ((sum[k] + num_samples / 2) / num_samples) << (k * 8);
+                }
+                ((uint*)color_buffer)[i] = result;
+            }
+        }
     }
-    int num = 0;
-    for(int i = 1; i + 1 < input.size(); i++) {
-        indexes[num] = input[0];
-        indexes[num + 1] = input[i];
-        indexes[num + 2] = input[i + 1];
-        num += 3;
+    pending_flags &= ~TILE_RESOLVED;
+}
+
+void framebuffer_t::materialize_span(int row, int x0, int x1, int flags) {
+    if(!(pending_flags & flags)) return ;
+    int base = (row >> tile_shift) * tiles_x;
+    for(int t = x0 >> tile_shift; t <= x1 >> tile_shift; t++) {
+        if(tile_state[base + t] & flags) materialize_tile(base + t, flags);
     }
-    return num;
 }
 
-struct vec2i {
-    vec2i() = default;    
+void* framebuffer_t::get_depth_row(int y, int x0, int x1, int sample) {
+    int row = height - y - 1;
+    materialize_span(row, x0, x1, TILE_DEPTH);
+    return depth_buffer + (sample * (size_t)width * height + (size_t)row * width) * depth_size;
+}
 
-    // 四舍五入
-    // vec2i(const vec2& v) : x(v.x()), y(v.y()) {}
-    vec2i(const vec2& v) : x(v.x() + 0.5f), y(v.y() + 0.5f) {}
-    vec2i(float x, float y) : x(x + 0.5f), y(y + 0.5f) {}
-    
-    vec2i(int x, int y) : x(x), y(y) {}
+void* framebuffer_t::get_color_row(int y, int x0, int x1, int sample) {
+    int row = height - y - 1;
+    materialize_span(row, x0, x1, TILE_COLOR);
+    return color_target + (sample * (size_t)width * height + (size_t)row * width) * color_size;
+}
 
-    const vec2i operator-(const vec2i& rhs) const {
-        return vec2i(x - rhs.x, y - rhs.y);
-    }
+uchar* framebuffer_t::get_stencil_row(int y, int sample) {
+    if(!stencil_buffer) return NULL;
+    return stencil_buffer + sample * (size_t)width * height + (size_t)(height - y - 1) * width;
+}
 
-    int x, y;
-};
+void framebuffer_t::materialize_color() { materialize_all(needs_resolve() ? TILE_RESOLVED : TILE_COLOR); }
 
-bbox_t calc_bbox(vec2i a, vec2i b, vec2i c) {
-    auto min3i = [](int a, int b, int c) {
-        return std::min(a, std::min(b, c));
-    };
-    auto max3i = [](int a, int b, int c) {
-        return std::max(a, std::max(b, c));
-    };
-    int xl = min3i(a.x, b.x, c.x);
-    int yl = min3i(a.y, b.y, c.y);
-    int xr = max3i(a.x, b.x, c.x);
-    int yr = max3i(a.y, b.y, c.y);
-    return bbox_t{xl, xr, yl, yr};
+void framebuffer_t::materialize_depth() { materialize_all(TILE_DEPTH); }
+
+const uchar* framebuffer_t::get_color_data() const {
+    assert(!(pending_flags & (needs_resolve() ? TILE_RESOLVED : TILE_COLOR)));
+    return color_buffer;
 }
 
-int edge_function(const vec2i& a, const vec2i& b, const vec2i& c) {
-    vec2i v1 = b - a, v2 = c - a;
-    return v1.x * v2.y - v2.x * v1.y;
+uchar* framebuffer_t::get_color_data() {
+    materialize_color();
+    return color_buffer;
 }
 
+const float* framebuffer_t::get_color_depth() const {
+    assert(depth_format == DEPTH_FORMAT_D32F);
+    assert(!(pending_flags & TILE_DEPTH));
+    return (const float*)depth_buffer;
+}
 
-// https://www.scratchapixel.com/lessons/3d-basic-rendering/rasterization-practical-implementation/rasterization-stage
-void rasterize(framebuffer_t* framebuffer, const v2f_t* v2fs[3], shader_t* shader, PRIMITIVE_TYPE type, int ignore_edge = 0) {
-    int width = framebuffer->get_width();
-    int height = framebuffer->get_height();
-    int sizeof_varyings = shader->get_sizeof_varyings();
-    
-    mat4 viewport_mat = viewport(width, height);
+namespace {
+const int max_num_of_varying_floats = 64;
 
-    float one_div_w[3];
-    vec4 p[3];
-    vec2i v[3];
+// 虚函数shader：varying大小在运行时确定，用固定大小的缓冲区存放
+class virtual_program_t {
+   public:
+    struct varyings_t {
+        float data[max_num_of_varying_floats];
+    };
 
-    for(int i = 0; i < 3; i++) {
-        one_div_w[i] = 1.0f / v2fs[i]->position.w();
-        p[i] = viewport_mat.mul_vec4(v2fs[i]->position * one_div_w[i]);
-        v[i] = vec2i(p[i].x(), p[i].y());
+    virtual_program_t(shader_t* _shader)
+        : shader(_shader), num_floats(_shader->get_sizeof_varyings() >> 2) {
+        assert(shader->get_sizeof_varyings() <= (int)sizeof(varyings_t));
     }
-    
-    vec2i edge0 = v[2] - v[1]; 
-    vec2i edge1 = v[0] - v[2]; 
-    vec2i edge2 = v[1] - v[0]; 
-
 
-    int area = edge_function(v[0], v[1], v[2]);
-    if(area == 0) return ;
+    int get_num_floats() const { return num_floats; }
 
-    // 背面剔除
-    int backface = sgn(area);
-    if(backface < 0) return ;
+    varying_mask_t get_varying_mask() const { return shader->get_used_varyings(); }
 
-    bbox_t bbox = calc_bbox(v[0], v[1], v[2]);
-    bbox.xl = std::max(bbox.xl, 0);
-    bbox.yl = std::max(bbox.yl, 0);
-    bbox.xr = std::min(bbox.xr, width - 1);
-    bbox.yr = std::min(bbox.yr, height - 1);
+    int get_num_outputs() const { return shader->get_num_outputs(); }
 
-    v2f_t v2f(sizeof_varyings);
+    const vec4& get_output(int index) const { return shader->get_output(index); }
 
-    auto shade = [&](int x, int y) {
-        vec2i cur_p(x, y);
-        // If the point is on the edge, test if it is a top or left edge, 
-        // otherwise test if  the edge function is ok
-        int da = edge_function(v[1], v[2], cur_p);
-        int db = edge_function(v[2], v[0], cur_p);
-        int dc = edge_function(v[0], v[1], cur_p);
+    bool may_discard() const { return shader->may_discard(); }
 
-        float alpha = 1.0f * da / area;
-        float beta  = 1.0f * db / area;
-        float gamma = 1.0f * dc / area;
+    bool writes_depth() const { return shader->writes_depth(); }
 
-        float z = alpha * p[0].z() + beta * p[1].z() + gamma * p[2].z();
-        float depth = (z + 1.0f) * 0.5f;
+    float get_depth_output() const { return shader->get_depth_output(); }
 
-        // 深度测试 - early Z
-        if(framebuffer->get_depth(x, y) < depth) return ;
+    void prepare() { shader->prepare(); }
 
-        // 重心坐标插值+透视矫正
-        vec3 uvw(alpha * one_div_w[0], beta * one_div_w[1], gamma * one_div_w[2]);
-        interpolation_v2f(v2fs[0], v2fs[1], v2fs[2], uvw, &v2f);
+    void set_derivatives(const varyings_t* dfdx, const varyings_t* dfdy) {
+        shader->bind_derivatives(dfdx ? dfdx->data : NULL, dfdy ? dfdy->data : NULL);
+    }
 
-        // fragment shader
-        bool discord = false;
-        vec4 color = shader->fragment_shader(v2f.data, discord);
-        if(discord) return ;
+    const vec4 vertex(const void* attribs, varyings_t& varyings) {
+        return shader->vertex_shader(attribs, varyings.data);
+    }
 
-        // update buffer
-        framebuffer->set_depth(x, y, depth);
-        framebuffer->set_color(x, y, color);
-    };
+    const vec4 instance_vertex(const void* attribs, const void* instance, varyings_t& varyings) {
+        return shader->instance_vertex_shader(attribs, instance, varyings.data);
+    }
 
-    auto rasterize_filled_triangle = [&]() {
-        for(int i = bbox.yl; i <= bbox.yr; i++) {
-            for(int j = bbox.xl; j <= bbox.xr; j++) {
-                // shade
-                bool overlaps = true;
-                vec2i P(j, i);
-                int da = edge_function(v[1], v[2], P);
-                int db = edge_function(v[2], v[0], P);
-                int dc = edge_function(v[0], v[1], P);
-                overlaps &= (da == 0 ? ((edge0.y == 0 && backface * edge0.x < 0) || backface * edge0.y < 0) : (backface * sgn(da) > 0)); 
-                overlaps &= (db == 0 ? ((edge1.y == 0 && backface * edge1.x < 0) || backface * edge1.y < 0) : (backface * sgn(db) > 0)); 
-                overlaps &= (dc == 0 ? ((edge2.y == 0 && backface * edge2.x < 0) || backface * edge2.y < 0) : (backface * sgn(dc) > 0)); 
-                if(overlaps) shade(j, i);
-            }
-        }
-    };
+    const vec4 fragment(const varyings_t& varyings, bool& discard) {
+        return shader->fragment_shader(varyings.data, discard);
+    }
 
-    auto rasterize_wire_frame_triangle = [&](int p1, int p2) {
-        int x0 = v[p1].x, y0 = v[p1].y;
-        int x1 = v[p2].x, y1 = v[p2].y;
-        int dx = abs(x0 - x1), dy = abs(y0 - y1);
-        if(dx < dy) {
-            std::swap(x0, y0);
-            std::swap(x1, y1);
-        }
-        if(x0 > x1) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
-        }
-        if(dx < dy) {
-            x1 = std::min(x1, height - 1);
-        } else {
-            x1 = std::min(x1, width - 1);
-        }
+   private:
+    shader_t* shader;
+    int num_floats;
+};
+}  // namespace
 
-        int A = y1 - y0;
-        int B = x0 - x1;
-        int C = -(A * x0 + B * y0);
+depth_state_t reverse_z_depth_state() {
+    depth_state_t state;
+    state.func = COMPARE_GEQUAL;
+    state.zero_to_one = true;
+    return state;
+}
 
-        int sgny = y0 < y1 ? 1 : -1;
+blend_state_t alpha_blend_state() {
+    blend_state_t state;
+    state.enable = true;
+    state.src_color = state.src_alpha = BLEND_SRC_ALPHA;
+    state.dst_color = state.dst_alpha = BLEND_ONE_MINUS_SRC_ALPHA;
+    return state;
+}
 
-        int d = 2 * A * (x0 + 1) + B * (2 * y0 + sgny) + 2 * C;
+blend_state_t additive_blend_state() {
+    blend_state_t state;
+    state.enable = true;
+    state.src_color = state.src_alpha = BLEND_ONE;
+    state.dst_color = state.dst_alpha = BLEND_ONE;
+    return state;
+}
 
-        int y = y0;
-        for(auto x = x0 ; x <= x1 ; ++x) {
-            if(x >= 0 && y >= 0) {
-                if(dx < dy) {
-                    if(y < width)
-                        shade(y, x);
-                } else {
-                    if(y < height)
-                        shade(x, y);
-                }
-            }
-            if(sgny * sgn(B) * sgn(d) < 0) {
-                d += 2 * (A + sgny * B);
-                y += sgny;
-            } else d += 2 * A; 
-        }
-    };
-    if(type == TRIANGLE) {
-        rasterize_filled_triangle();
-    }
-    else if(type == TRIANGLE_WIRE_FRAME) {
-        if(!(ignore_edge & 1)) rasterize_wire_frame_triangle(0, 1);
-        if(!(ignore_edge & 2)) rasterize_wire_frame_triangle(1, 2);
-        if(!(ignore_edge & 4)) rasterize_wire_frame_triangle(2, 0);
-    }
-    else {
-        assert(0 && "Unknown primitive type!");
+void sort_back_to_front(const mat4& view_matrix, const vec3* centers, int count, int* order) {
+    std::vector<float> depth(count);
+    for(int i = 0; i < count; i++) {
+        order[i] = i;
+        // 相机朝向z轴负方向，z越小越远
+        depth[i] = view_matrix.mul_vec4(vec4(centers[i], 1.0f)).z();
     }
+    std::stable_sort(order, order + count, [&](int a, int b) { return depth[a] < depth[b]; });
 }
 
-}  // namespace render
-}  // namespace
-
-void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, shader_t* shader, PRIMITIVE_TYPE type) {
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, shader_t* shader, PRIMITIVE_TYPE type,
+                     const render_state_t* state) {
     assert(framebuffer && data && shader);
-    using namespace render;
+    virtual_program_t program(shader);
+    render::draw(framebuffer, data, NULL, program, type, state);
+}
 
-    int sizeof_varyings = shader->get_sizeof_varyings();
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, shader_t* shader,
+                     PRIMITIVE_TYPE type, const render_state_t* state) {
+    assert(framebuffer && data && indices && shader);
+    virtual_program_t program(shader);
+    render::draw(framebuffer, data, indices, program, type, state);
+}
 
-    int indexes[3 * max_num_of_v2fs];
-    v2f_t* v2fs[max_num_of_v2fs];
-    for(int i = 0; i < max_num_of_v2fs; i++) {
-        v2fs[i] = new v2f_t(sizeof_varyings);
-    }
+void draw_primitives_instanced(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, const vbo_t* instances,
+                               shader_t* shader, PRIMITIVE_TYPE type, const render_state_t* state) {
+    assert(framebuffer && data && instances && shader);
+    virtual_program_t program(shader);
+    render::draw_instanced(framebuffer, data, indices, instances, program, type, state);
+}
 
-    int count = data->get_count();
-    for(int i = 0; i < count; i += 3) {
-        for(int j = 0; j < 3; j++) {
-            int ind = i + j;
-            vec4 position = shader->vertex_shader(data->at(ind), v2fs[j]->data);
-            v2fs[j]->position = position;
-        }
-        int num = clip_aganst_panels(v2fs, indexes);
-        const v2f_t* tr_v2fs[3];
-        for(int i = 0; i < num; i += 3) {
-            for(int j = 0; j < 3; j++) {
-                tr_v2fs[j] = v2fs[indexes[i + j]];
-            }
-            if(num == 3) {
-                rasterize(framebuffer, tr_v2fs, shader, type, 0);
-            } else if(i == 0) {
-                rasterize(framebuffer, tr_v2fs, shader, type, 4);
-            } else if(i == num - 3) {
-                rasterize(framebuffer, tr_v2fs, shader, type, 1);
-            } else {
-                rasterize(framebuffer, tr_v2fs, shader, type, 1 | 4);
-            }
-        }
-    }
+void command_list_t::draw(const vbo_t* data, const ibo_t* indices, shader_t* shader, const void* uniforms, int sizeof_uniforms,
+                          PRIMITIVE_TYPE type, const render_state_t* state) {
+    assert(data && shader && uniforms);
+    virtual_program_t program(shader);
+    record(new render::deferred_draw_impl_t<virtual_program_t>(program, shader, uniforms, sizeof_uniforms, data, indices, type, state),
+           shader, data, state);
+}
 
-    for(int i = 0; i < max_num_of_v2fs; i++) {
-        delete v2fs[i];
-    }
-}
\ No newline at end of file
+void draw_depth(framebuffer_t* framebuffer, const vbo_t* data, shader_t* shader, const render_state_t* state) {
+    assert(framebuffer && data && shader);
+    virtual_program_t program(shader);
+    render::draw_depth(framebuffer, data, NULL, program, TRIANGLE, state);
+}
+
+void draw_depth(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, shader_t* shader,
+                PRIMITIVE_TYPE type, const render_state_t* state) {
+    assert(framebuffer && data && indices && shader);
+    virtual_program_t program(shader);
+    render::draw_depth(framebuffer, data, indices, program, type, state);
+}
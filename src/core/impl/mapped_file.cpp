@@ -0,0 +1,106 @@
+#include "core/mapped_file.h"
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool query_file_stamp(const std::string& filename, file_stamp_t& stamp) {
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0) return false;
+    stamp.mtime = (long long)st.st_mtime;
+    stamp.size = (long long)st.st_size;
+    return true;
+}
+
+std::string make_temp_name(const std::string& filename) {
+    static std::atomic<unsigned> counter(0);
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    return filename + "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+}
+
+bool replace_file(const std::string& temp_name, const std::string& filename) {
+#ifdef _WIN32
+    bool succeed = MoveFileExA(temp_name.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool succeed = rename(temp_name.c_str(), filename.c_str()) == 0;
+#endif
+    if(!succeed) remove(temp_name.c_str());
+    return succeed;
+}
+
+#ifdef _WIN32
+mapped_file_t::mapped_file_t(const std::string& filename)
+    : view(NULL),
+      length(0),
+      succeed(false),
+      file_handle(INVALID_HANDLE_VALUE),
+      mapping_handle(NULL) {
+    file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file_handle == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file_handle, &file_size)) return;
+    length = (size_t)file_size.QuadPart;
+    succeed = true;
+    // 空文件无法映射
+    if(length == 0) return;
+    mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping_handle == NULL) {
+        succeed = false;
+        return;
+    }
+    view = (const char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    succeed = view != NULL;
+}
+
+mapped_file_t::~mapped_file_t() {
+    if(view) UnmapViewOfFile(view);
+    if(mapping_handle) CloseHandle(mapping_handle);
+    if(file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+}
+#else
+mapped_file_t::mapped_file_t(const std::string& filename)
+    : view(NULL), length(0), succeed(false) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    struct stat st;
+    if(fstat(fd, &st) == 0) {
+        length = (size_t)st.st_size;
+        succeed = true;
+        // 空文件无法映射
+        if(length > 0) {
+            void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p == MAP_FAILED) {
+                succeed = false;
+            } else {
+                view = (const char*)p;
+            }
+        }
+    }
+    // 映射建立后即可关闭文件
+    close(fd);
+}
+
+mapped_file_t::~mapped_file_t() {
+    if(view) munmap((void*)view, length);
+}
+#endif
+
+bool mapped_file_t::is_succeed() const { return succeed; }
+
+const char* mapped_file_t::data() const { return view; }
+
+size_t mapped_file_t::size() const { return succeed ? length : 0; }
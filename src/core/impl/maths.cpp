@@ -435,9 +435,15 @@ const mat4 scale(vec3 sc) {
                 0.0f, 0.0f, 0.0f, 1.0f);
 }
 
-const mat4 ortho(float n, float f, float fov, float aspect) {
+const mat4 ortho(float n, float f, float fov, float aspect, bool reverse_z) {
     float t = tan(radian(fov) / 2.0f) * f;
     float r = aspect * t;
+    if(reverse_z) {
+        return mat4(1.0f / r, 0.0f, 0.0f, 0.0f, 
+                    0.0f, 1.0f / t, 0.0f, 0.0f, 
+                    0.0f, 0.0f, 1.0f / (f - n), f / (f - n), 
+                    0.0f, 0.0f, 0.0f, 1.0f);
+    }
     return mat4(1.0f / r, 0.0f, 0.0f, 0.0f, 
                 0.0f, 1.0f / t, 0.0f, 0.0f, 0.0f,
                 0.0f, 2.0f / (n - f), (n + f) / (n - f), 
@@ -445,9 +451,16 @@ const mat4 ortho(float n, float f, float fov, float aspect) {
 }
 
 // fov: degree
-const mat4 perspective(float n, float f, float fov, float aspect) {
+const mat4 perspective(float n, float f, float fov, float aspect, bool reverse_z) {
     float t = tan(radian(fov) / 2.0f) * n;
     float r = aspect * t;
+    if(reverse_z) {
+        // z_ndc = n / (f - n) * (f / -z_view - 1)，近平面为1，远平面为0
+        return mat4(n / r, 0.0f, 0.0f, 0.0f, 
+                    0.0f, n / t, 0.0f, 0.0f, 
+                    0.0f, 0.0f, n / (f - n), n * f / (f - n), 
+                    0.0f, 0.0f, -1.0f, 0.0f);
+    }
     return mat4(n / r, 0.0f, 0.0f, 0.0f, 
                 0.0f, n / t, 0.0f, 0.0f, 
                 0.0f, 0.0f, (n + f) / (n - f), 2.0f * n * f / (n - f), 
@@ -1,11 +1,17 @@
 #include "core/mesh.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <vector>
 
+#include "core/mapped_file.h"
+
 namespace {
 vbo_t* convert_to_vbo(const std::vector<vertex_t>& vertexes) {
     vbo_t* vbo = new vbo_t(sizeof(vertex_t), vertexes.size());
@@ -13,141 +19,324 @@ vbo_t* convert_to_vbo(const std::vector<vertex_t>& vertexes) {
     return vbo;
 }
 
-vbo_t* load_from_file(const std::string& filename) {
-    std::vector<vertex_t> verts;
+// 手写的解析函数，OBJ文件中的数字格式都很简单，不需要istringstream
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+const char* skip_space(const char* p, const char* end) {
+    while(p < end && is_space(*p)) p++;
+    return p;
+}
+
+const char* skip_line(const char* p, const char* end) {
+    while(p < end && *p != '\n') p++;
+    return p < end ? p + 1 : p;
+}
+
+const char* parse_int(const char* p, const char* end, int& value) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+    int result = 0;
+    while(p < end && is_digit(*p)) result = result * 10 + (*p++ - '0');
+    value = negative ? -result : result;
+    return p;
+}
+
+const char* parse_float(const char* p, const char* end, float& value) {
+    const static double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17};
+    p = skip_space(p, end);
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+    double result = 0.0;
+    while(p < end && is_digit(*p)) result = result * 10.0 + (*p++ - '0');
+    if(p < end && *p == '.') {
+        p++;
+        double fraction = 0.0;
+        int digits = 0;
+        while(p < end && is_digit(*p)) {
+            // 超出double精度的位数直接丢弃
+            if(digits < 17) {
+                fraction = fraction * 10.0 + (*p - '0');
+                digits++;
+            }
+            p++;
+        }
+        result += fraction / powers[digits];
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        int exponent;
+        p = parse_int(p + 1, end, exponent);
+        result *= pow(10.0, exponent);
+    }
+    value = (float)(negative ? -result : result);
+    return p;
+}
+
+// OBJ的索引从1开始，负数表示相对于当前已读取元素的倒数位置
+bool resolve_index(int index, int count, int& result) {
+    result = index > 0 ? index - 1 : count + index;
+    return index != 0 && result >= 0 && result < count;
+}
 
-    std::ifstream in;
-    in.open(filename, std::ifstream::in);
-    if(in.fail()) {
+struct corner_t {
+    int v, t, n;
+};
+
+const char* parse_corner(const char* p, const char* end, corner_t& corner) {
+    corner.t = corner.n = 0;
+    p = parse_int(p, end, corner.v);
+    if(p < end && *p == '/') {
+        p++;
+        if(p < end && *p != '/') p = parse_int(p, end, corner.t);
+        if(p < end && *p == '/') p = parse_int(p + 1, end, corner.n);
+    }
+    return p;
+}
+
+vbo_t* load_from_file(const std::string& filename) {
+    mapped_file_t file(filename);
+    if(!file.is_succeed()) {
         std::cerr << "Error: can not open file" << std::endl;
         return NULL;
     }
 
+    std::vector<vertex_t> verts;
     std::vector<vec3> vertexes;
     std::vector<vec3> normals;
     std::vector<vec2> uvs;
-    std::vector<int> facet_vrt;
-    std::vector<int> facet_norm;
-    std::vector<int> facet_uv;
-
-    std::string line;
-    while(!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if(!line.compare(0, 2, "v ")) {
-            iss >> trash;
+    std::vector<corner_t> polygon;
+
+    const char* p = file.data();
+    const char* end = p + file.size();
+    while(p < end) {
+        p = skip_space(p, end);
+        if(end - p > 2 && p[0] == 'v' && is_space(p[1])) {
             float x, y, z;
-            iss >> x >> y >> z;
+            p = parse_float(p + 2, end, x);
+            p = parse_float(p, end, y);
+            p = parse_float(p, end, z);
             vertexes.emplace_back(x, y, z);
-        } else if(!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
+        } else if(end - p > 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) {
             float x, y, z;
-            iss >> x >> y >> z;
-            vec3 n(x, y, z);
-            normals.emplace_back(n.normalized());
-        } else if(!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
+            p = parse_float(p + 3, end, x);
+            p = parse_float(p, end, y);
+            p = parse_float(p, end, z);
+            normals.emplace_back(vec3(x, y, z).normalized());
+        } else if(end - p > 3 && p[0] == 'v' && p[1] == 't' && is_space(p[2])) {
             float u, v;
-            iss >> u >> v;
+            p = parse_float(p + 3, end, u);
+            p = parse_float(p, end, v);
             uvs.emplace_back(u, v);
-        }
-    }
-    bool has_normal = !normals.empty();
-    bool has_uv = !uvs.empty();
-    if(!has_normal) {
-        normals.resize(vertexes.size(), vec3(0.0f));
-    }
-
-    in.clear();
-    in.seekg(0);
-    while(!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if(!line.compare(0, 2, "f ")) {
-            int f, t, n;
-            iss >> trash;
-            int cnt = 0;
-            while(iss >> f) {
-                cnt++;
-                facet_vrt.push_back(--f);
-                iss >> trash;
-                if(has_uv) {
-                    iss >> t;
-                    facet_uv.push_back(--t);
-                }
-                if(has_normal) {
-                    iss >> trash >> n;
-                    facet_norm.push_back(--n);
-                } else {
-                    facet_norm.push_back(f);
+        } else if(end - p > 2 && p[0] == 'f' && is_space(p[1])) {
+            polygon.clear();
+            p = skip_space(p + 2, end);
+            while(p < end && (is_digit(*p) || *p == '-')) {
+                corner_t corner;
+                p = parse_corner(p, end, corner);
+                bool valid = resolve_index(corner.v, vertexes.size(), corner.v);
+                if(valid && corner.t) valid = resolve_index(corner.t, uvs.size(), corner.t);
+                else corner.t = -1;
+                if(valid && corner.n) valid = resolve_index(corner.n, normals.size(), corner.n);
+                else corner.n = -1;
+                if(!valid) {
+                    std::cerr << "Error: invalid face index in the obj file" << std::endl;
+                    return NULL;
                 }
+                polygon.push_back(corner);
+                p = skip_space(p, end);
             }
-            if(3 != cnt) {
-                std::cerr
-                    << "Error: the obj file is supposed to be triangulated"
-                    << std::endl;
-                in.close();
+            if(polygon.size() < 3) {
+                std::cerr << "Error: the face has less than 3 vertexes" << std::endl;
                 return NULL;
             }
-        }
-    }
-
-    for(int i = 0; i < facet_vrt.size(); i += 3) {
-        vec3 &a = vertexes[facet_vrt[i + 0]], &b = vertexes[facet_vrt[i + 1]],
-             &c = vertexes[facet_vrt[i + 2]];
-        vec3 edge1 = b - a;
-        vec3 edge2 = c - a;
-        vec3 f_normal = cross(edge1, edge2).normalized();
-        for(int j = 0; j < 3; j++) {
-            int f = facet_vrt[i + j];
-            int n = facet_norm[i + j];
-            vertex_t vert;
-            vert.position = vertexes[f];
-            if(!has_normal) {
-                vert.normal = f_normal;
-            } else {
-                vert.normal = normals[n].normalized();
-            }
-            if(!facet_uv.empty()) {
-                int t = facet_uv[i + j];
-                vert.texcoord = uvs[t];
+            // 多边形按扇形拆分成三角形
+            for(int i = 1, n = (int)polygon.size(); i + 1 < n; i++) {
+                const corner_t* tri[3] = {&polygon[0], &polygon[i], &polygon[i + 1]};
+                vec3 &a = vertexes[tri[0]->v], &b = vertexes[tri[1]->v], &c = vertexes[tri[2]->v];
+                vec3 edge1 = b - a;
+                vec3 edge2 = c - a;
+                vec3 f_normal = cross(edge1, edge2).normalized();
+                bool has_uv = true;
+                for(int j = 0; j < 3; j++) {
+                    vertex_t vert;
+                    vert.position = vertexes[tri[j]->v];
+                    if(tri[j]->n < 0) {
+                        vert.normal = f_normal;
+                    } else {
+                        vert.normal = normals[tri[j]->n].normalized();
+                    }
+                    if(tri[j]->t >= 0) {
+                        vert.texcoord = uvs[tri[j]->t];
+                    } else {
+                        has_uv = false;
+                    }
+                    verts.push_back(vert);
+                }
+                if(has_uv) {
+                    int ind = verts.size() - 3;
+                    vec2 deltaUV1 = verts[ind + 1].texcoord - verts[ind].texcoord;
+                    vec2 deltaUV2 = verts[ind + 2].texcoord - verts[ind].texcoord;
+                    float k = 1.0f / std::max((deltaUV1.x() * deltaUV2.y() -
+                                               deltaUV2.x() * deltaUV1.y()),
+                                              EPSILON);
+                    vec3 tangent =
+                        (vec3(deltaUV2.y() * edge1.x() - deltaUV1.y() * edge2.x(),
+                              deltaUV2.y() * edge1.y() - deltaUV1.y() * edge2.y(),
+                              deltaUV2.y() * edge1.z() - deltaUV1.y() * edge2.z()) *
+                         k)
+                            .normalized();
+                    verts[ind].tangent = tangent;
+                    verts[ind + 1].tangent = tangent;
+                    verts[ind + 2].tangent = tangent;
+                }
             }
-            verts.push_back(vert);
-        }
-        if(!facet_uv.empty()) {
-            int ind = verts.size() - 3;
-            vec2 deltaUV1 = verts[ind + 1].texcoord - verts[ind].texcoord;
-            vec2 deltaUV2 = verts[ind + 2].texcoord - verts[ind].texcoord;
-            float k = 1.0f / std::max((deltaUV1.x() * deltaUV2.y() -
-                                       deltaUV2.x() * deltaUV1.y()),
-                                      EPSILON);
-            vec3 tangent =
-                (vec3(deltaUV2.y() * edge1.x() - deltaUV1.y() * edge2.x(),
-                      deltaUV2.y() * edge1.y() - deltaUV1.y() * edge2.y(),
-                      deltaUV2.y() * edge1.z() - deltaUV1.y() * edge2.z()) *
-                 k)
-                    .normalized();
-            vec3 bitangent = cross(f_normal, tangent).normalized();
-            verts[ind].tangent = tangent;
-            verts[ind + 1].tangent = tangent;
-            verts[ind + 2].tangent = tangent;
         }
+        p = skip_line(p, end);
     }
-    in.close();
     return convert_to_vbo(verts);
 }
+
+/** 二进制网格缓存 **/
+// 文件头之后是按data_offset对齐的vertex_t数组（扁平的三角形列表，与vbo布局一致）
+const char mesh_cache_magic[4] = {'M', 'B', 'I', 'N'};
+const uint mesh_cache_version = 1;
+const uint mesh_cache_alignment = 64;
+
+struct mesh_cache_header_t {
+    char magic[4];
+    uint version;
+    uint sizeof_vertex;
+    uint vertex_count;
+    uint data_offset;
+    uint padding;
+    file_stamp_t source;
+    float bbox_min[3];
+    float bbox_max[3];
+};
+
+const std::string get_cache_name(const std::string& filename) {
+    return filename + ".mbin";
+}
+
+const mesh_cache_header_t* check_cache(const mapped_file_t* cache, const file_stamp_t& source) {
+    if(!cache->is_succeed() || cache->size() < sizeof(mesh_cache_header_t)) return NULL;
+    const mesh_cache_header_t* header = (const mesh_cache_header_t*)cache->data();
+    if(memcmp(header->magic, mesh_cache_magic, 4) || header->version != mesh_cache_version ||
+       header->sizeof_vertex != sizeof(vertex_t) || header->source.mtime != source.mtime ||
+       header->source.size != source.size) {
+        return NULL;
+    }
+    if(header->data_offset % mesh_cache_alignment ||
+       cache->size() < header->data_offset + (size_t)header->vertex_count * sizeof(vertex_t)) {
+        return NULL;
+    }
+    return header;
+}
+
+void write_cache(const std::string& filename, const file_stamp_t& source, const vbo_t* vbo,
+                 const vec3& bbox_min, const vec3& bbox_max) {
+    mesh_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, mesh_cache_magic, 4);
+    header.version = mesh_cache_version;
+    header.sizeof_vertex = sizeof(vertex_t);
+    header.vertex_count = vbo->get_count();
+    header.data_offset = mesh_cache_alignment;
+    header.source = source;
+    memcpy(header.bbox_min, bbox_min.data(), sizeof(header.bbox_min));
+    memcpy(header.bbox_max, bbox_max.data(), sizeof(header.bbox_max));
+    static_assert(sizeof(mesh_cache_header_t) <= mesh_cache_alignment, "header is too large");
+
+    // 先写各自的临时文件再改名，避免同时加载同一个模型时读到或发布写了一半的缓存
+    std::string cache_name = get_cache_name(filename);
+    std::string temp_name = make_temp_name(cache_name);
+    std::ofstream out(temp_name, std::ios::binary | std::ios::trunc);
+    if(out.fail()) return;
+    char padding[mesh_cache_alignment] = {0};
+    out.write((const char*)&header, sizeof(header));
+    out.write(padding, header.data_offset - sizeof(header));
+    out.write((const char*)vbo->data(), vbo->get_totol_size());
+    out.close();
+    if(out.fail()) {
+        remove(temp_name.c_str());
+        return;
+    }
+    replace_file(temp_name, cache_name);
+}
 };  // namespace
 
 mesh_t::mesh_t(const std::string& filename)
-    : vbo(load_from_file(filename)) {}
+    : vbo(NULL), cache(NULL), bbox_min(0.0f), bbox_max(0.0f) {
+    load_from_cache(filename);
+}
 
 mesh_t::mesh_t(const std::vector<vertex_t>& vertexes)
-    : vbo(convert_to_vbo(vertexes)) {}
+    : vbo(convert_to_vbo(vertexes)), cache(NULL), bbox_min(0.0f), bbox_max(0.0f) {
+    calc_bbox();
+}
 
 mesh_t::~mesh_t() {
     if(vbo) delete vbo;
+    if(cache) delete cache;
+}
+
+void mesh_t::load_from_cache(const std::string& filename) {
+    file_stamp_t source;
+    if(!query_file_stamp(filename, source)) {
+        std::cerr << "Error: can not open file" << std::endl;
+        return;
+    }
+    cache = new mapped_file_t(get_cache_name(filename));
+    const mesh_cache_header_t* header = check_cache(cache, source);
+    if(header) {
+        vbo = new vbo_t(sizeof(vertex_t), header->vertex_count, cache->data() + header->data_offset);
+        bbox_min = vec3(header->bbox_min);
+        bbox_max = vec3(header->bbox_max);
+        return;
+    }
+    delete cache;
+    cache = NULL;
+
+    vbo = load_from_file(filename);
+    if(!vbo) return;
+    calc_bbox();
+    write_cache(filename, source, vbo, bbox_min, bbox_max);
+}
+
+void mesh_t::calc_bbox() {
+    int count = vbo ? vbo->get_count() : 0;
+    if(count == 0) return;
+    const vertex_t* vertexes = (const vertex_t*)vbo->data();
+    bbox_min = bbox_max = vertexes[0].position;
+    for(int i = 1; i < count; i++) {
+        const vec3& p = vertexes[i].position;
+        for(int k = 0; k < 3; k++) {
+            bbox_min.data()[k] = std::min(bbox_min.data()[k], p.data()[k]);
+            bbox_max.data()[k] = std::max(bbox_max.data()[k], p.data()[k]);
+        }
+    }
 }
 
 const vbo_t* mesh_t::get_vbo() const { return vbo; }
+
+const vec3 mesh_t::get_bbox_min() const { return bbox_min; }
+
+const vec3 mesh_t::get_bbox_max() const { return bbox_max; }
+
+ibo_t* create_grid_strip_indices(int num_x, int num_y) {
+    assert(num_x >= 2 && num_y >= 2);
+    // 每条strip 2 * num_x个索引，strip之间一个restart
+    ibo_t* indices = new ibo_t((num_y - 1) * (2 * num_x + 1) - 1);
+    int n = 0;
+    for(int y = 0; y + 1 < num_y; y++) {
+        if(y > 0) indices->at(n++) = primitive_restart_index;
+        for(int x = 0; x < num_x; x++) {
+            indices->at(n++) = (y + 1) * num_x + x;
+            indices->at(n++) = y * num_x + x;
+        }
+    }
+    return indices;
+}
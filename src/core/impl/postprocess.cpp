@@ -0,0 +1,188 @@
+#include "core/postprocess.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <future>
+
+#include "utils/ThreadPool.h"
+
+namespace {
+inline uint lerp_rgba8(uint a, uint b, int t) {
+    uint result = 0;
+    for(int k = 0; k < 32; k += 8) {
+        int ca = (a >> k) & 0xff, cb = (b >> k) & 0xff;
+        result |= (uint)(ca + (((cb - ca) * t) >> 8)) << k;
+    }
+    return result;
+}
+}  // namespace
+
+fxaa_t::fxaa_t()
+    : contrast_threshold(0.0312f),
+      relative_threshold(0.063f),
+      subpixel_blending(0.75f),
+      width(0),
+      height(0),
+      target(NULL) {}
+
+void fxaa_t::set_quality(float _contrast_threshold, float _relative_threshold, float _subpixel_blending) {
+    contrast_threshold = _contrast_threshold;
+    relative_threshold = _relative_threshold;
+    subpixel_blending = _subpixel_blending;
+}
+
+void fxaa_t::apply(framebuffer_t* framebuffer) {
+    assert(framebuffer);
+    width = framebuffer->get_width();
+    height = framebuffer->get_height();
+    target = (uint*)framebuffer->get_color_data();
+    luma.resize(width * height);
+
+    // 沿竖直边缘搜索会读到其他块的亮度，两遍之间需要等所有行的亮度都算完
+    parallel_rows(height, [this](int begin, int end) { compute_luma(begin, end); });
+    parallel_rows(height, [this](int begin, int end) { filter_rows(begin, end); });
+    for(const change_t& change : deferred) target[change.index] = change.color;
+    deferred.clear();
+}
+
+// 循环里没有分支，可以被编译器向量化；加权和不超过16位，按16位计算一次能处理的像素多一倍
+void fxaa_t::compute_luma(int row_begin, int row_end) {
+    const uint* src = target + row_begin * width;
+    uchar* dst = luma.data() + row_begin * width;
+    int count = (row_end - row_begin) * width;
+    for(int i = 0; i < count; i++) {
+        uint c = src[i];
+        ushort r = c & 0xff, g = (c >> 8) & 0xff, b = (c >> 16) & 0xff;
+        dst[i] = (uchar)((ushort)(r * 77 + g * 150 + b * 29) >> 8);
+    }
+}
+
+void fxaa_t::defer_changes(const std::vector<change_t>& changes) {
+    std::lock_guard<std::mutex> lock(deferred_lock);
+    deferred.insert(deferred.end(), changes.begin(), changes.end());
+}
+
+void fxaa_t::filter_rows(int row_begin, int row_end) {
+    // 沿边缘搜索端点的最大步数
+    const int search_steps = 10;
+    const int contrast = (int)(contrast_threshold * 255.0f);
+    const uchar* L = luma.data();
+
+    auto clamp_x = [this](int x) { return std::min(std::max(x, 0), width - 1); };
+    auto clamp_y = [this](int y) { return std::min(std::max(y, 0), height - 1); };
+
+    const int relative = (int)(relative_threshold * 256.0f);
+    const uchar min_range = (uchar)std::min(contrast, 255);
+    std::vector<uchar> candidates(width);
+    // 上一行和这一行修改的像素。上一行在这一行处理完之后写回，处理第y行时y - 1到y + 1行都是原始颜色
+    std::vector<change_t> previous, current;
+
+    for(int y = row_begin; y < row_end; y++) {
+        current.clear();
+        // 行号为缓冲区中的行，n为上一行，s为下一行
+        const uchar* ln = L + clamp_y(y - 1) * width;
+        const uchar* lm = L + y * width;
+        const uchar* ls = L + clamp_y(y + 1) * width;
+
+        // 先对整行做对比度测试，大部分像素在这里被排除。这个循环没有分支，全部按8位计算，可以向量化；
+        // 只测试固定阈值，得到的是需要处理的像素的超集，相对阈值在下面逐像素测试
+        for(int x = 1; x + 1 < width; x++) {
+            uchar highest = std::max(std::max(std::max(ln[x], ls[x]), std::max(lm[x - 1], lm[x + 1])), lm[x]);
+            uchar lowest = std::min(std::min(std::min(ln[x], ls[x]), std::min(lm[x - 1], lm[x + 1])), lm[x]);
+            candidates[x] = (uchar)(highest - lowest) >= min_range;
+        }
+        candidates[0] = candidates[width - 1] = 1;
+
+        for(int x = 0; x < width; x++) {
+            // 一次跳过16个不需要处理的像素
+            if(x + 16 <= width) {
+                unsigned long long group[2];
+                memcpy(group, &candidates[x], sizeof(group));
+                if(!(group[0] | group[1])) {
+                    x += 15;
+                    continue;
+                }
+            }
+            if(!candidates[x]) continue;
+            int xw = clamp_x(x - 1), xe = clamp_x(x + 1);
+            int m = lm[x], n = ln[x], s = ls[x], w = lm[xw], e = lm[xe];
+            int highest = std::max(std::max(std::max(n, s), std::max(w, e)), m);
+            int lowest = std::min(std::min(std::min(n, s), std::min(w, e)), m);
+            int range = highest - lowest;
+            if(range < std::max(contrast, (highest * relative) >> 8)) continue;
+
+            int nw = ln[xw], ne = ln[xe], sw = ls[xw], se = ls[xe];
+
+            // 子像素混合：中心与周围加权平均亮度的差异越大，混合越多
+            float filter = (2 * (n + e + s + w) + ne + nw + se + sw) / 12.0f;
+            filter = std::min(fabsf(filter - m) / range, 1.0f);
+            filter = filter * filter * (3.0f - 2.0f * filter);
+            float subpixel_blend = filter * filter * subpixel_blending;
+
+            // 比较两个方向的二阶差分，判断是水平边（沿x延伸）还是竖直边
+            int horizontal = 2 * abs(n + s - 2 * m) + abs(ne + se - 2 * e) + abs(nw + sw - 2 * w);
+            int vertical = 2 * abs(e + w - 2 * m) + abs(ne + nw - 2 * n) + abs(se + sw - 2 * s);
+            bool is_horizontal = horizontal >= vertical;
+
+            // 梯度较大的一侧是边缘的另一侧
+            int p_luma = is_horizontal ? s : e;
+            int n_luma = is_horizontal ? n : w;
+            int p_gradient = abs(p_luma - m), n_gradient = abs(n_luma - m);
+            int step = p_gradient < n_gradient ? -1 : 1;
+            int opposite = step < 0 ? n_luma : p_luma;
+            int gradient = std::max(p_gradient, n_gradient);
+
+            int ox = is_horizontal ? x : clamp_x(x + step);
+            int oy = is_horizontal ? clamp_y(y + step) : y;
+            int dx = is_horizontal ? 1 : 0, dy = 1 - dx;
+
+            // 沿边缘向两端搜索，边缘两侧亮度的平均值与起点相差超过梯度的1/4时认为到达端点
+            float edge_luma = (m + opposite) * 0.5f;
+            float gradient_threshold = gradient * 0.25f;
+            auto edge_delta = [&](int k) {
+                int a = L[clamp_y(y + dy * k) * width + clamp_x(x + dx * k)];
+                int b = L[clamp_y(oy + dy * k) * width + clamp_x(ox + dx * k)];
+                return (a + b) * 0.5f - edge_luma;
+            };
+            int p_distance = search_steps, n_distance = search_steps;
+            float p_delta = 0.0f, n_delta = 0.0f;
+            for(int k = 1; k <= search_steps; k++) {
+                p_delta = edge_delta(k);
+                if(fabsf(p_delta) >= gradient_threshold) {
+                    p_distance = k;
+                    break;
+                }
+            }
+            for(int k = 1; k <= search_steps; k++) {
+                n_delta = edge_delta(-k);
+                if(fabsf(n_delta) >= gradient_threshold) {
+                    n_distance = k;
+                    break;
+                }
+            }
+
+            // 离较近的端点越近混合越多；端点处亮度变化方向与中心一致时不需要混合
+            int distance = std::min(p_distance, n_distance);
+            bool delta_sign = p_distance <= n_distance ? p_delta >= 0.0f : n_delta >= 0.0f;
+            float edge_blend = 0.0f;
+            if(delta_sign != (m - edge_luma >= 0.0f)) {
+                edge_blend = 0.5f - (float)distance / (p_distance + n_distance);
+            }
+
+            float blend = std::max(subpixel_blend, edge_blend);
+            int t = (int)(blend * 256.0f);
+            if(t <= 0) continue;
+            current.push_back(change_t{y * width + x, lerp_rgba8(target[y * width + x], target[oy * width + ox], t)});
+        }
+
+        if(y == row_begin) {
+            defer_changes(current);
+            current.clear();
+        }
+        for(const change_t& change : previous) target[change.index] = change.color;
+        std::swap(previous, current);
+    }
+    defer_changes(previous);
+}
@@ -1,12 +1,57 @@
 #include "core/shader.h"
 
+#include <cassert>
 #include <cstring>
 
 shader_t::shader_t(int sizeof_varyings)
-    : uniforms(NULL), sizeof_varyings(sizeof_varyings) {}
+    : uniforms(NULL),
+      sizeof_varyings(sizeof_varyings),
+      used_varyings(ALL_VARYINGS),
+      dfdx_varyings(NULL),
+      dfdy_varyings(NULL),
+      num_outputs(1),
+      discard_flag(true),
+      depth_flag(false),
+      depth_output(0.0f) {}
 
 shader_t::~shader_t() {}
 
+void shader_t::prepare() {}
+
+// 默认的实现不知道实例属性的格式，所有实例都会画在同一个位置，因此直接报错
+const vec4 shader_t::instance_vertex_shader(const void *attribs, const void * /* instance_attribs */, void *varyings) {
+    assert(!"draw_primitives_instanced needs a shader that overrides instance_vertex_shader");
+    return vertex_shader(attribs, varyings);
+}
+
 int shader_t::get_sizeof_varyings() const { return sizeof_varyings; }
 
-void shader_t::bind_uniform(void *uniform_data) { uniforms = uniform_data; }
\ No newline at end of file
+varying_mask_t shader_t::get_used_varyings() const { return used_varyings; }
+
+void shader_t::set_used_varyings(varying_mask_t mask) { used_varyings = mask; }
+
+void shader_t::bind_uniform(void *uniform_data) { uniforms = uniform_data; }
+
+void shader_t::bind_derivatives(const void *dfdx, const void *dfdy) {
+    dfdx_varyings = dfdx;
+    dfdy_varyings = dfdy;
+}
+
+int shader_t::get_num_outputs() const { return num_outputs; }
+
+void shader_t::set_num_outputs(int num) {
+    assert(num >= 1 && num <= max_num_of_outputs);
+    num_outputs = num;
+}
+
+bool shader_t::may_discard() const { return discard_flag; }
+
+bool shader_t::writes_depth() const { return depth_flag; }
+
+void shader_t::set_may_discard(bool value) { discard_flag = value; }
+
+void shader_t::set_writes_depth(bool value) { depth_flag = value; }
+
+const void *shader_t::get_dfdx() const { return dfdx_varyings; }
+
+const void *shader_t::get_dfdy() const { return dfdy_varyings; }
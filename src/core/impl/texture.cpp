@@ -1,8 +1,13 @@
 #include "core/texture.h"
 
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <vector>
 
+#include "core/mapped_file.h"
 #include "core/maths.h"
 
 namespace {
@@ -11,6 +16,76 @@ vec4 bilinear(vec4 i00, vec4 i10, vec4 i01, vec4 i11, float u, float v) {
     vec4 i1 = i01 + (i11 - i01) * u;
     return i0 + (i1 - i0) * v;
 }
+
+/** 纹理缓存 **/
+// 文件头之后按data_offset对齐，依次存放每一层的texel。第0层的texel是LDR图片不做颜色空间转换
+// 得到的（USAGE_SRGB_COLOR、USAGE_RAW_DATA）时保存为RGBA8，是无损的；其余的第0层和所有mipmap保存为vec4。
+// 加载时直接映射，采样时按各层的格式读取
+const char texture_cache_magic[4] = {'T', 'B', 'I', 'N'};
+const uint texture_cache_version = 3;
+const uint texture_cache_alignment = 64;
+
+enum { TEXEL_FORMAT_RGBA8, TEXEL_FORMAT_RGBA32F };
+
+struct texture_cache_header_t {
+    char magic[4];
+    uint version;
+    uint usage;
+    uint level0_format;
+    int width, height;
+    int num_levels;
+    uint data_offset;
+    file_stamp_t source;
+};
+
+const std::string get_cache_name(const std::string& filename, usage_t usage) {
+    return filename + "." + std::to_string((int)usage) + ".tbin";
+}
+
+int count_texels(int width, int height, int num_levels) {
+    int total = 0;
+    for(int i = 0; i < num_levels; i++) {
+        total += width * height;
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+    return total;
+}
+
+size_t cache_data_size(int width, int height, int num_levels, uint level0_format) {
+    size_t level0 = (size_t)width * height;
+    size_t mipmaps = count_texels(width, height, num_levels) - level0;
+    return level0 * (level0_format == TEXEL_FORMAT_RGBA8 ? 4 : sizeof(vec4)) + mipmaps * sizeof(vec4);
+}
+
+template <class Fetch>
+vec4 sample_texels(int width, int height, sample_interp_mode_t interp_mode, float u, float v, Fetch fetch) {
+    if(interp_mode == SAMPLE_INTERP_MODE_NEAREST) {
+        int x = std::min(int(u * width), width - 1);
+        int y = std::min(int(v * height), height - 1);
+        return fetch(y * width + x);
+    } else if(interp_mode == SAMPLE_INTERP_MODE_BILINEAR) {
+        int x = u * (width - 1);
+        int y = v * (height - 1);
+        if(x == width - 1 || y == height - 1) return fetch(y * width + x);
+        float local_u = u * (width - 1) - x;
+        float local_v = v * (height - 1) - y;
+        return bilinear(fetch(y * width + x), fetch(y * width + x + 1),
+                        fetch(y * width + x + width),
+                        fetch(y * width + x + width + 1), local_u, local_v);
+    }
+    return vec4(0.0f);
+}
+
+int count_levels(int width, int height, int max_levels) {
+    int num = 1;
+    while((width > 1 || height > 1) && num < max_levels) {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        num++;
+    }
+    return num;
+}
 }  // namespace
 
 void texture_t::ldr_image_to_texture(image_t* image) {
@@ -71,24 +146,155 @@ void texture_t::linear_to_srgb() {
 }
 
 texture_t::texture_t(int w, int h)
-    : width(w), height(h), buffer(NULL), border_color(0.0f) {
+    : width(w), height(h), buffer(NULL), border_color(0.0f), num_levels(1), cache(NULL) {
     int total = width * height;
     buffer = new vec4[total];
+    levels[0] = level_t{width, height, false, buffer};
 }
 
 texture_t::texture_t(const std::string& filename, usage_t usage)
-    : width(), height(), buffer(NULL), border_color(0.0f) {
+    : width(), height(), buffer(NULL), border_color(0.0f), num_levels(1), cache(NULL) {
+    if(load_from_cache(filename, usage)) return;
     image_t image(filename);
     width = image.get_width();
     height = image.get_height();
-    buffer = new vec4[height * width];
+    buffer = new vec4[count_texels(width, height, count_levels(width, height, max_levels))];
+    levels[0] = level_t{width, height, false, buffer};
     load_from_image(&image, usage);
+    num_levels = count_levels(width, height, max_levels);
+    generate_mipmaps();
+    // 第0层的值都是k / 255时可以无损地保存为RGBA8
+    bool rgba8 = image.get_format() == FORMAT_LDR && usage != USAGE_LINEAR_COLOR;
+    if(image.is_succeed()) write_cache(filename, usage, rgba8 ? TEXEL_FORMAT_RGBA8 : TEXEL_FORMAT_RGBA32F);
 }
 
 texture_t::~texture_t() {
-    if(buffer) delete[] buffer;
+    delete cache;
+    delete[] buffer;
+}
+
+bool texture_t::load_from_cache(const std::string& filename, usage_t usage) {
+    file_stamp_t source;
+    if(!query_file_stamp(filename, source)) return false;
+    mapped_file_t* file = new mapped_file_t(get_cache_name(filename, usage));
+    const texture_cache_header_t* header = (const texture_cache_header_t*)file->data();
+    bool valid = file->is_succeed() && file->size() >= sizeof(texture_cache_header_t);
+    valid = valid && !memcmp(header->magic, texture_cache_magic, 4) &&
+            header->version == texture_cache_version && header->usage == (uint)usage &&
+            (header->level0_format == TEXEL_FORMAT_RGBA8 || header->level0_format == TEXEL_FORMAT_RGBA32F) &&
+            header->source.mtime == source.mtime && header->source.size == source.size;
+    valid = valid && header->width > 0 && header->height > 0 &&
+            header->num_levels == count_levels(header->width, header->height, max_levels) &&
+            header->data_offset % texture_cache_alignment == 0 &&
+            file->size() >= header->data_offset + cache_data_size(header->width, header->height, header->num_levels,
+                                                                  header->level0_format);
+    if(!valid) {
+        delete file;
+        return false;
+    }
+    cache = file;
+    width = header->width;
+    height = header->height;
+    num_levels = header->num_levels;
+    bool rgba8 = header->level0_format == TEXEL_FORMAT_RGBA8;
+    const char* texels = file->data() + header->data_offset;
+    levels[0] = level_t{width, height, rgba8, texels};
+    texels += (size_t)width * height * (rgba8 ? 4 : sizeof(vec4));
+    int w = width, h = height;
+    for(int i = 1; i < num_levels; i++) {
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+        levels[i] = level_t{w, h, false, texels};
+        texels += (size_t)w * h * sizeof(vec4);
+    }
+    return true;
+}
+
+void texture_t::write_cache(const std::string& filename, usage_t usage, uint level0_format) const {
+    file_stamp_t source;
+    if(!query_file_stamp(filename, source)) return;
+    texture_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, texture_cache_magic, 4);
+    header.version = texture_cache_version;
+    header.usage = usage;
+    header.level0_format = level0_format;
+    header.width = width;
+    header.height = height;
+    header.num_levels = num_levels;
+    header.data_offset = texture_cache_alignment;
+    header.source = source;
+    static_assert(sizeof(texture_cache_header_t) <= texture_cache_alignment, "header is too large");
+
+    // 先写各自的临时文件再改名，避免同时加载同一张纹理时读到或发布写了一半的缓存
+    std::string cache_name = get_cache_name(filename, usage);
+    std::string temp_name = make_temp_name(cache_name);
+    std::ofstream out(temp_name, std::ios::binary | std::ios::trunc);
+    if(out.fail()) return;
+    char padding[texture_cache_alignment] = {0};
+    out.write((const char*)&header, sizeof(header));
+    out.write(padding, header.data_offset - sizeof(header));
+    int level0 = width * height;
+    if(level0_format == TEXEL_FORMAT_RGBA8) {
+        std::vector<uchar> packed((size_t)level0 * 4);
+        for(int i = 0; i < level0; i++) {
+            for(int k = 0; k < 4; k++) packed[i * 4 + k] = (uchar)(clamp(buffer[i].data()[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+        out.write((const char*)packed.data(), packed.size());
+    } else {
+        out.write((const char*)buffer, sizeof(vec4) * level0);
+    }
+    out.write((const char*)(buffer + level0), sizeof(vec4) * (count_texels(width, height, num_levels) - level0));
+    out.close();
+    if(out.fail()) {
+        remove(temp_name.c_str());
+        return;
+    }
+    replace_file(temp_name, cache_name);
 }
 
+// 2x2盒式滤波逐层下采样，奇数尺寸时最后一行/列重复使用
+void texture_t::generate_mipmaps() {
+    vec4* src_texels = buffer;
+    for(int i = 1; i < num_levels; i++) {
+        const level_t& src = levels[i - 1];
+        level_t& dst = levels[i];
+        dst.width = std::max(src.width / 2, 1);
+        dst.height = std::max(src.height / 2, 1);
+        dst.rgba8 = false;
+        vec4* dst_texels = src_texels + src.width * src.height;
+        dst.texels = dst_texels;
+        for(int y = 0; y < dst.height; y++) {
+            int y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+            for(int x = 0; x < dst.width; x++) {
+                int x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+                dst_texels[y * dst.width + x] =
+                    (src_texels[y0 * src.width + x0] + src_texels[y0 * src.width + x1] +
+                     src_texels[y1 * src.width + x0] + src_texels[y1 * src.width + x1]) * 0.25f;
+            }
+        }
+        src_texels = dst_texels;
+    }
+}
+
+// 写入第0层前调用：原来的mipmap已经过期，之后只采样第0层。
+// 映射的缓存是只读的，先把第0层展开到自己的内存中
+void texture_t::prepare_write() {
+    if(cache) {
+        buffer = new vec4[width * height];
+        const level_t& level = levels[0];
+        for(int i = 0; i < width * height; i++) {
+            buffer[i] = level.rgba8 ? rgbapack2rgba((const uchar*)level.texels + i * 4) : ((const vec4*)level.texels)[i];
+        }
+        delete cache;
+        cache = NULL;
+    }
+    num_levels = 1;
+    levels[0] = level_t{width, height, false, buffer};
+}
+
+int texture_t::get_num_levels() const { return num_levels; }
+
 void texture_t::set_interp_mode(sample_interp_mode_t _interp_mode) {
     interp_mode = _interp_mode;
 }
@@ -108,6 +314,7 @@ void texture_t::load_from_file(const std::string& filename, usage_t usage) {
 void texture_t::load_from_image(image_t* image, usage_t usage) {
     assert(image && image->is_succeed() && width == image->get_width() &&
            height == image->get_height());
+    prepare_write();
     image->flip_h();
     if(image->get_format() == FORMAT_LDR) {
         ldr_image_to_texture(image);
@@ -123,8 +330,9 @@ void texture_t::load_from_image(image_t* image, usage_t usage) {
 }
 
 void texture_t::load_from_colorbuffer(framebuffer_t* framebuffer) {
-    assert(framebuffer && width == framebuffer->get_height() &&
-           height == framebuffer->get_width());
+    assert(framebuffer && width == framebuffer->get_width() &&
+           height == framebuffer->get_height());
+    prepare_write();
     for(int i = 0; i < height; i++) {
         for(int j = 0; j < width; j++) {
             buffer[i * width + j] = framebuffer->get_color(j, i);
@@ -133,8 +341,9 @@ void texture_t::load_from_colorbuffer(framebuffer_t* framebuffer) {
 }
 
 void texture_t::load_from_depthbuffer(framebuffer_t* framebuffer) {
-    assert(framebuffer && width == framebuffer->get_height() &&
-           height == framebuffer->get_width());
+    assert(framebuffer && width == framebuffer->get_width() &&
+           height == framebuffer->get_height());
+    prepare_write();
     for(int i = 0; i < height; i++) {
         for(int j = 0; j < width; j++) {
             buffer[i * width + j] = vec4(framebuffer->get_depth(j, i));
@@ -142,10 +351,10 @@ void texture_t::load_from_depthbuffer(framebuffer_t* framebuffer) {
     }
 }
 
-vec4 texture_t::sample(vec2 uv) {
-    float u = uv.u(), v = uv.v();
+// 返回false表示落在边界外，应直接使用border_color
+bool texture_t::wrap_uv(float& u, float& v) const {
     if(surround_mode == SAMPLE_SURROUND_MODE_BORDER) {
-        if(u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f) return border_color;
+        if(u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f) return false;
     } else if(surround_mode == SAMPLE_SURROUND_MODE_CLAMP) {
         u = clamp(u, 0.0f, 1.0f);
         v = clamp(v, 0.0f, 1.0f);
@@ -153,19 +362,95 @@ vec4 texture_t::sample(vec2 uv) {
         u = u - floor(u);
         v = v - floor(v);
     }
+    return true;
+}
+
+vec4 texture_t::sample_level(const level_t& level, float u, float v) const {
+    if(level.rgba8) {
+        const uchar* texels = (const uchar*)level.texels;
+        return sample_texels(level.width, level.height, interp_mode, u, v,
+                             [texels](int i) { return rgbapack2rgba(texels + i * 4); });
+    }
+    const vec4* texels = (const vec4*)level.texels;
+    return sample_texels(level.width, level.height, interp_mode, u, v, [texels](int i) { return texels[i]; });
+}
+
+vec4 texture_t::sample(vec2 uv) {
+    float u = uv.u(), v = uv.v();
+    if(!wrap_uv(u, v)) return border_color;
+    return sample_level(levels[0], u, v);
+}
+
+vec4 texture_t::sample(vec2 uv, float lod) {
+    float u = uv.u(), v = uv.v();
+    if(!wrap_uv(u, v)) return border_color;
+    lod = clamp(lod, 0.0f, num_levels - 1.0f);
+    int level = (int)lod;
+    float t = lod - level;
+    // 最近点采样时也只取最近的一层
     if(interp_mode == SAMPLE_INTERP_MODE_NEAREST) {
-        int x = std::min(int(u * width), width - 1);
-        int y = std::min(int(v * height), height - 1);
-        return buffer[y * width + x];
-    } else if(interp_mode == SAMPLE_INTERP_MODE_BILINEAR) {
-        int x = u * (width - 1);
-        int y = v * (height - 1);
-        if(x == width - 1 || y == height - 1) return buffer[y * width + x];
-        float local_u = u * (width - 1) - x;
-        float local_v = v * (height - 1) - y;
-        return bilinear(buffer[y * width + x], buffer[y * width + x + 1],
-                        buffer[y * width + x + width],
-                        buffer[y * width + x + width + 1], local_u, local_v);
+        return sample_level(levels[t < 0.5f ? level : level + 1], u, v);
     }
-    return vec4(0.0f);
-}
\ No newline at end of file
+    vec4 color = sample_level(levels[level], u, v);
+    if(t > 0.0f) {
+        color = color + (sample_level(levels[level + 1], u, v) - color) * t;
+    }
+    return color;
+}
+
+vec4 texture_t::sample(vec2 uv, vec2 duvdx, vec2 duvdy) {
+    if(num_levels == 1) return sample(uv);
+    vec2 size((float)width, (float)height);
+    float rho = std::max((duvdx * size).length_squared(), (duvdy * size).length_squared());
+    // log2(sqrt(rho))
+    float lod = rho > 1.0f ? 0.5f * log2(rho) : 0.0f;
+    return sample(uv, lod);
+}
+
+depth_texture_t::depth_texture_t(const framebuffer_t* framebuffer, const depth_state_t& depth)
+    : framebuffer(framebuffer),
+      zero_to_one(depth.zero_to_one),
+      reversed(depth.func == COMPARE_GREATER || depth.func == COMPARE_GEQUAL) {
+    assert(framebuffer && framebuffer->get_num_samples() == 1);
+}
+
+int depth_texture_t::get_width() const { return framebuffer->get_width(); }
+
+int depth_texture_t::get_height() const { return framebuffer->get_height(); }
+
+float depth_texture_t::reference_depth(float ndc_z, float bias) const {
+    float depth = zero_to_one ? ndc_z : (ndc_z + 1.0f) * 0.5f;
+    return reversed ? depth + bias : depth - bias;
+}
+
+// 坐标在范围外时返回最远处
+float depth_texture_t::fetch(int x, int y) const {
+    int width = framebuffer->get_width(), height = framebuffer->get_height();
+    if(x < 0 || x >= width || y < 0 || y >= height) return reversed ? 0.0f : 1.0f;
+    return framebuffer->get_depth(x, y);
+}
+
+bool depth_texture_t::is_lit(float ref, float depth) const { return reversed ? ref >= depth : ref <= depth; }
+
+float depth_texture_t::sample(vec2 uv) const {
+    int x = (int)floor(uv.x() * framebuffer->get_width() + 0.5f);
+    int y = (int)floor(uv.y() * framebuffer->get_height() + 0.5f);
+    return fetch(x, y);
+}
+
+float depth_texture_t::sample_compare(vec2 uv, float ref) const {
+    return is_lit(ref, sample(uv)) ? 1.0f : 0.0f;
+}
+
+float depth_texture_t::sample_pcf(vec2 uv, float ref, int radius) const {
+    int x = (int)floor(uv.x() * framebuffer->get_width() + 0.5f);
+    int y = (int)floor(uv.y() * framebuffer->get_height() + 0.5f);
+    int lit = 0;
+    for(int i = -radius; i <= radius; i++) {
+        for(int j = -radius; j <= radius; j++) {
+            lit += is_lit(ref, fetch(x + j, y + i));
+        }
+    }
+    int size = 2 * radius + 1;
+    return (float)lit / (size * size);
+}
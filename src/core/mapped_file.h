@@ -0,0 +1,44 @@
+#ifndef RASTERIZER_MAPPED_FILE_H_
+#define RASTERIZER_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+// 文件的修改时间和大小，用于判断缓存文件是否过期
+struct file_stamp_t {
+    long long mtime;
+    long long size;
+};
+
+bool query_file_stamp(const std::string& filename, file_stamp_t& stamp);
+
+// 写缓存用的临时文件名，同一进程内和不同进程之间都不会重复
+std::string make_temp_name(const std::string& filename);
+// 用写好的临时文件替换filename，失败时删除临时文件。多个线程同时替换时filename总是完整的某一份
+bool replace_file(const std::string& temp_name, const std::string& filename);
+
+// 只读的内存映射文件
+class mapped_file_t {
+   public:
+    mapped_file_t(const std::string& filename);
+    ~mapped_file_t();
+
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+    bool is_succeed() const;
+
+    const char* data() const;
+    size_t size() const;
+
+   private:
+    const char* view;
+    size_t length;
+    bool succeed;
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#endif
+};
+
+#endif  // RASTERIZER_MAPPED_FILE_H_
@@ -7,5 +7,6 @@
 
 using uint = unsigned int;
 using uchar = unsigned char;
+using ushort = unsigned short;
 
 #endif  // RASTERIZER_MACRO_H_
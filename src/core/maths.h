@@ -2,6 +2,7 @@
 #define RASTERIZER_MATHS_H_
 
 #include <cmath>
+#include <cstring>
 
 #include "marco.h"
 
@@ -219,6 +220,41 @@ inline const vec4 rgbapack2rgba(const uchar* color) {
     return vec4(color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f, color[3] / 255.0f);
 }
 
+// IEEE 754半精度浮点，就近舍入到偶数，超出范围变为无穷大
+inline ushort float2half(float value) {
+    uint f;
+    memcpy(&f, &value, sizeof(f));
+    uint sign = (f >> 16) & 0x8000;
+    uint abs = f & 0x7fffffff;
+    if(abs >= 0x7f800000) return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    if(abs >= 0x47800000) return sign | 0x7c00;
+    if(abs < 0x38800000) {
+        // 非规格化数，最小的单位为2^-24
+        if(abs < 0x33000000) return sign;
+        uint e = abs >> 23, m = (abs & 0x7fffff) | 0x800000;
+        int shift = 126 - e;
+        uint h = m >> shift, rem = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if(rem > halfway || (rem == halfway && (h & 1))) h++;
+        return sign | h;
+    }
+    uint h = (abs >> 13) - ((127 - 15) << 10), rem = abs & 0x1fff;
+    if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | h;
+}
+
+inline float half2float(ushort h) {
+    uint sign = (uint)(h & 0x8000) << 16;
+    uint e = (h >> 10) & 0x1f, m = h & 0x3ff;
+    if(e == 0) {
+        float value = m * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+    uint f = sign | (e == 31 ? 0x7f800000 | (m << 13) : ((e + 112) << 23) | (m << 13));
+    float value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
 inline const vec4 rgbpack2rgba(const uchar* color) {
     return vec4(color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f, 1.0f);
 }
@@ -246,8 +282,10 @@ const mat4 scale(vec3 _scale);
 const mat4 euler_YXZ_rotate(vec3 rotation);
 const mat4 rotate(vec3 axis, float angle);
 
-const mat4 ortho(float n, float f, float zoom, float aspect);
-const mat4 perspective(float n, float f, float zoom, float aspect);
+// reverse_z为true时把[n, f]映射到裁剪空间的z / w ∈ [1, 0]（默认为[-1, 1]），远处的深度接近0，
+// 浮点深度缓冲的精度在整个范围内大致均匀。需要配合reverse_z_depth_state()使用，深度清除为0
+const mat4 ortho(float n, float f, float zoom, float aspect, bool reverse_z = false);
+const mat4 perspective(float n, float f, float zoom, float aspect, bool reverse_z = false);
 const mat4 lookat(vec3 eye, vec3 at, vec3 up);
 const mat4 viewport(int width, int height);
 
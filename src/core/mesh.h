@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "graphics.h"
+#include "mapped_file.h"
 #include "maths.h"
 
 struct vertex_t {
@@ -14,6 +15,8 @@ struct vertex_t {
     vec3 tangent;
 };
 
+// 从OBJ文件加载时会在旁边写入二进制缓存<filename>.mbin，
+// 之后的加载直接映射缓存文件，vbo不拷贝数据
 class mesh_t {
    public:
     mesh_t(const std::string& filename);
@@ -25,8 +28,20 @@ class mesh_t {
 
     const vbo_t* get_vbo() const;
 
+    const vec3 get_bbox_min() const;
+    const vec3 get_bbox_max() const;
+
    private:
+    void load_from_cache(const std::string& filename);
+    void calc_bbox();
+
     vbo_t* vbo;
+    mapped_file_t* cache;
+    vec3 bbox_min, bbox_max;
 };
 
+// 规则网格（地形等）的索引：num_x * num_y个顶点按行存放，顶点(x, y)的下标为y * num_x + x。
+// 相邻两行组成一条TRIANGLE_STRIP，之间用primitive_restart_index分隔；x向右、y向上看时为正面
+ibo_t* create_grid_strip_indices(int num_x, int num_y);
+
 #endif  // RASTERIZER_MESH_H_
\ No newline at end of file
@@ -0,0 +1,1515 @@
+#ifndef RASTERIZER_PIPELINE_H_
+#define RASTERIZER_PIPELINE_H_
+
+/**
+ * 渲染管线的模板实现，虚函数shader和模板shader共用这一份代码。
+ * program需要提供：
+ *     typedef ... varyings_t;                  varying的存储类型，全部由float组成
+ *     int get_num_floats() const;              varying中float的个数
+ *     varying_mask_t get_varying_mask() const; fragment会读取的varying，在prepare()之后调用
+ *     int get_num_outputs() const;             fragment的输出个数，在prepare()之后调用
+ *     const vec4& get_output(int index) const; fragment之后读取第index个输出（index >= 1）
+ *     bool may_discard() const;                fragment是否可能discard，在prepare()之后调用
+ *     bool writes_depth() const;               fragment是否修改深度，在prepare()之后调用
+ *     float get_depth_output() const;          fragment之后读取写入的深度
+ *     void prepare();                          每次绘制前调用一次
+ *     void set_derivatives(const varyings_t* dfdx, const varyings_t* dfdy);
+ *                                              设置当前quad的屏幕空间导数，指向光栅化函数的局部变量，
+ *                                              每个图元光栅化结束时以(NULL, NULL)清除
+ *     const vec4 vertex(const void* attribs, varyings_t& varyings);
+ *     const vec4 instance_vertex(const void* attribs, const void* instance, varyings_t& varyings);
+ *                                              实例化绘制时代替vertex，可能在多个线程中同时调用
+ *     const vec4 fragment(const varyings_t& varyings, bool& discard);
+ * varyings_t可以是空结构体，此时只插值深度。
+ * 只应被graphics.cpp和需要显式实例化draw_primitives<Shader>的源文件包含。
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "command_list.h"
+#include "graphics.h"
+#include "shader.h"
+#include "utils/ThreadPool.h"
+
+namespace render {
+const int max_num_of_v2fs = 20;
+
+template <class Varyings>
+struct v2f_t {
+    vec4 position;
+    Varyings varyings;
+
+    float* data() { return (float*)&varyings; }
+    const float* data() const { return (const float*)&varyings; }
+};
+
+// 空结构体的sizeof为1，不能直接除以sizeof(float)
+template <class Varyings>
+struct num_floats_of {
+    static const int value = std::is_empty<Varyings>::value ? 0 : sizeof(Varyings) / sizeof(float);
+    // 用于声明数组，至少为1
+    static const int capacity = value > 0 ? value : 1;
+};
+
+struct bbox_t {
+    int xl, xr;
+    int yl, yr;
+};
+
+template <class Varyings>
+void lerp_v2f(const v2f_t<Varyings>* a, const v2f_t<Varyings>* b, float t, int count, v2f_t<Varyings>* target) {
+    target->position = a->position + (b->position - a->position) * t;
+    const float* data_a = a->data();
+    const float* data_b = b->data();
+    float* data_c = target->data();
+    for(int i = 0; i < count; i++) {
+        data_c[i] = data_a[i] + (data_b[i] - data_a[i]) * t;
+    }
+}
+
+// 裁剪空间的6个平面，zero_to_one为true时裁剪空间的z范围为[0, w]，否则为[-w, w]
+inline const vec4& clip_plane(int i, bool zero_to_one) {
+    const static vec4 planes[6]{
+        vec4(0, 0, 1, 1),   // near
+        vec4(0, 0, -1, 1),  // far
+        vec4(1, 0, 0, 1),   // left
+        vec4(-1, 0, 0, 1),  // right
+        vec4(0, 1, 0, 1),   // top
+        vec4(0, -1, 0, 1)   // bottom
+    };
+    // z >= 0，reverse Z时为远平面
+    const static vec4 zero_plane(0, 0, 1, 0);
+    return (i == 0 && zero_to_one) ? zero_plane : planes[i];
+}
+
+// v2fs的前3个是输入的三角形，裁剪产生的新顶点依次写在后面
+template <class Varyings>
+int clip_aganst_panels(v2f_t<Varyings>* v2fs, int count, int indexes[], bool zero_to_one = false) {
+    // 三角形被6个平面裁剪后最多9个顶点
+    int buffer[2][max_num_of_v2fs];
+    int* input = buffer[0];
+    int* output = buffer[1];
+    int num_input = 3, num_output = 0;
+    int cur = 0;
+    for(int i = 0; i < 3; i++) {
+        input[i] = cur++;
+    }
+    for(int i = 0; num_input && i < 6; i++) {
+        const vec4& C = clip_plane(i, zero_to_one);
+        int p = 0, s = num_input - 1;
+
+        for(; p < num_input; s = p++) {
+            int pp = input[p], sp = input[s];
+
+            float d1 = v2fs[pp].position.dot(C);
+            float d2 = v2fs[sp].position.dot(C);
+            int situation = ((d1 >= 0) | ((d2 >= 0) << 1));
+
+            if(situation == 0) {
+                // do nothing
+            } else if(situation == 1) {
+                if(fabs(d1 - d2) > EPSILON) {
+                    lerp_v2f(&v2fs[pp], &v2fs[sp], d1 / (d1 - d2), count, &v2fs[cur]);
+                    output[num_output++] = cur;
+                    cur++;
+                }
+                output[num_output++] = pp;
+            } else if(situation == 2) {
+                if(fabs(d1 - d2) > EPSILON) {
+                    lerp_v2f(&v2fs[pp], &v2fs[sp], d1 / (d1 - d2), count, &v2fs[cur]);
+                    output[num_output++] = cur;
+                    cur++;
+                }
+            } else if(situation == 3) {
+                output[num_output++] = pp;
+            }
+        }
+        std::swap(input, output);
+        num_input = num_output;
+        num_output = 0;
+    }
+    int num = 0;
+    for(int i = 1; i + 1 < num_input; i++) {
+        indexes[num] = input[0];
+        indexes[num + 1] = input[i];
+        indexes[num + 2] = input[i + 1];
+        num += 3;
+    }
+    return num;
+}
+
+// 线段a, b的裁剪（Liang-Barsky），完全在外面时返回false。
+// 端点没有被裁剪时result直接指向a或b，否则插值到buffer中
+template <class Varyings>
+bool clip_line(const v2f_t<Varyings>* a, const v2f_t<Varyings>* b, int count, bool zero_to_one,
+               v2f_t<Varyings> buffer[2], const v2f_t<Varyings>* result[2]) {
+    float t0 = 0.0f, t1 = 1.0f;
+    for(int i = 0; i < 6; i++) {
+        const vec4& C = clip_plane(i, zero_to_one);
+        float d1 = a->position.dot(C);
+        float d2 = b->position.dot(C);
+        if(d1 < 0 && d2 < 0) return false;
+        if(d1 >= 0 && d2 >= 0) continue;
+        float t = d1 / (d1 - d2);
+        if(d1 < 0) t0 = std::max(t0, t);
+        else t1 = std::min(t1, t);
+        if(t0 > t1) return false;
+    }
+    result[0] = a;
+    result[1] = b;
+    if(t0 > 0.0f) {
+        lerp_v2f(a, b, t0, count, &buffer[0]);
+        result[0] = &buffer[0];
+    }
+    if(t1 < 1.0f) {
+        lerp_v2f(a, b, t1, count, &buffer[1]);
+        result[1] = &buffer[1];
+    }
+    return true;
+}
+
+// 点在所有平面以内时不被裁剪
+inline bool clip_point(const vec4& position, bool zero_to_one) {
+    for(int i = 0; i < 6; i++) {
+        if(position.dot(clip_plane(i, zero_to_one)) < 0) return false;
+    }
+    return true;
+}
+
+// 三角形裁剪后的多边形在屏幕上是否为正面（逆时针），完全被裁掉时返回false。
+// v2fs的前3个是三角形，后面的空间被裁剪使用
+template <class Varyings>
+bool is_front_facing(v2f_t<Varyings>* v2fs, bool zero_to_one) {
+    int indexes[3 * max_num_of_v2fs];
+    int num = clip_aganst_panels(v2fs, 0, indexes, zero_to_one);
+    float area = 0.0f;
+    for(int i = 0; i < num; i += 3) {
+        vec4 a = v2fs[indexes[i]].position, b = v2fs[indexes[i + 1]].position, c = v2fs[indexes[i + 2]].position;
+        float ax = a.x() / a.w(), ay = a.y() / a.w();
+        float bx = b.x() / b.w(), by = b.y() / b.w();
+        float cx = c.x() / c.w(), cy = c.y() / c.w();
+        area += (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+    }
+    return area > 0.0f;
+}
+
+struct vec2i {
+    vec2i() = default;
+
+    // 四舍五入
+    // vec2i(const vec2& v) : x(v.x()), y(v.y()) {}
+    vec2i(const vec2& v) : x(v.x() + 0.5f), y(v.y() + 0.5f) {}
+    vec2i(float x, float y) : x(x + 0.5f), y(y + 0.5f) {}
+
+    vec2i(int x, int y) : x(x), y(y) {}
+
+    const vec2i operator-(const vec2i& rhs) const {
+        return vec2i(x - rhs.x, y - rhs.y);
+    }
+
+    const vec2i operator+(const vec2i& rhs) const {
+        return vec2i(x + rhs.x, y + rhs.y);
+    }
+
+    int x, y;
+};
+
+inline bbox_t calc_bbox(vec2i a, vec2i b, vec2i c) {
+    auto min3i = [](int a, int b, int c) {
+        return std::min(a, std::min(b, c));
+    };
+    auto max3i = [](int a, int b, int c) {
+        return std::max(a, std::max(b, c));
+    };
+    int xl = min3i(a.x, b.x, c.x);
+    int yl = min3i(a.y, b.y, c.y);
+    int xr = max3i(a.x, b.x, c.x);
+    int yr = max3i(a.y, b.y, c.y);
+    return bbox_t{xl, xr, yl, yr};
+}
+
+inline int edge_function(const vec2i& a, const vec2i& b, const vec2i& c) {
+    vec2i v1 = b - a, v2 = c - a;
+    return v1.x * v2.y - v2.x * v1.y;
+}
+
+// 多重采样时顶点坐标保留的亚像素精度，采样点偏移以1/subpixel_scale像素为单位
+const int subpixel_scale = 8;
+const int max_sample_offset = 3;
+const int max_num_of_samples = 4;
+
+// 采样点相对像素中心的偏移（与D3D的标准采样模式相同）
+inline void get_sample_pattern(int num_samples, const int*& offset_x, const int*& offset_y) {
+    static const int x1[] = {0}, y1[] = {0};
+    static const int x2[] = {-2, 2}, y2[] = {-2, 2};
+    static const int x4[] = {-1, 3, -3, 1}, y4[] = {-3, -1, 1, 3};
+    switch(num_samples) {
+        case 2: offset_x = x2; offset_y = y2; break;
+        case 4: offset_x = x4; offset_y = y4; break;
+        default: offset_x = x1; offset_y = y1; break;
+    }
+}
+
+// 向下/向上取整的整数除法，b > 0
+inline int floor_div(int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+inline int ceil_div(int a, int b) { return -floor_div(-a, b); }
+
+// 按framebuffer的存储格式读写颜色和深度，row为get_color_row/get_depth_row返回的行指针。
+// D16/D24为定点数，深度测试直接比较编码后的值，同一个深度编码的结果总是相同的
+inline ushort encode_depth16(float depth) { return (ushort)(clamp(depth, 0.0f, 1.0f) * 65535.0f + 0.5f); }
+inline uint encode_depth24(float depth) { return (uint)(clamp(depth, 0.0f, 1.0f) * 16777215.0 + 0.5); }
+
+// a func b，用于模板测试和深度测试
+template <class T>
+inline bool compare(COMPARE_FUNC func, T a, T b) {
+    switch(func) {
+        case COMPARE_NEVER: return false;
+        case COMPARE_LESS: return a < b;
+        case COMPARE_EQUAL: return a == b;
+        case COMPARE_LEQUAL: return a <= b;
+        case COMPARE_GREATER: return a > b;
+        case COMPARE_NOTEQUAL: return a != b;
+        case COMPARE_GEQUAL: return a >= b;
+        default: return true;
+    }
+}
+
+// depth func 已经保存的深度
+inline bool depth_test(COMPARE_FUNC func, DEPTH_FORMAT format, const void* row, int x, float depth) {
+    switch(format) {
+        case DEPTH_FORMAT_D16: return compare<uint>(func, encode_depth16(depth), ((const ushort*)row)[x]);
+        case DEPTH_FORMAT_D24: return compare<uint>(func, encode_depth24(depth), ((const uint*)row)[x]);
+        default: return compare(func, depth, ((const float*)row)[x]);
+    }
+}
+
+inline void store_depth(DEPTH_FORMAT format, void* row, int x, float depth) {
+    switch(format) {
+        case DEPTH_FORMAT_D16: ((ushort*)row)[x] = encode_depth16(depth); break;
+        case DEPTH_FORMAT_D24: ((uint*)row)[x] = encode_depth24(depth); break;
+        default: ((float*)row)[x] = depth; break;
+    }
+}
+
+inline float load_depth(DEPTH_FORMAT format, const void* row, int x) {
+    switch(format) {
+        case DEPTH_FORMAT_D16: return ((const ushort*)row)[x] / 65535.0f;
+        case DEPTH_FORMAT_D24: return (float)(((const uint*)row)[x] / 16777215.0);
+        default: return ((const float*)row)[x];
+    }
+}
+
+// 把encode_color编码好的size字节写入dst，大小固定的memcpy会被编译成一次store
+inline void store_color(uchar* dst, const void* value, int size) {
+    if(size == 4) {
+        memcpy(dst, value, 4);
+    } else if(size == 8) {
+        memcpy(dst, value, 8);
+    } else {
+        memcpy(dst, value, 16);
+    }
+}
+
+// dst至少有16字节
+inline void encode_color(COLOR_FORMAT format, const vec4& color, void* dst) {
+    switch(format) {
+        case COLOR_FORMAT_RGBA16F: {
+            ushort* h = (ushort*)dst;
+            for(int i = 0; i < 4; i++) h[i] = float2half(color.data()[i]);
+            break;
+        }
+        case COLOR_FORMAT_RGBA32F: memcpy(dst, color.data(), 16); break;
+        default: *(uint*)dst = rgba2rgbapack(color); break;
+    }
+}
+
+inline const vec4 decode_color(COLOR_FORMAT format, const void* src) {
+    switch(format) {
+        case COLOR_FORMAT_RGBA16F: {
+            const ushort* h = (const ushort*)src;
+            return vec4(half2float(h[0]), half2float(h[1]), half2float(h[2]), half2float(h[3]));
+        }
+        case COLOR_FORMAT_RGBA32F: return vec4((const float*)src);
+        default: return rgbapack2rgba((const uchar*)src);
+    }
+}
+
+// 混合的实现方式，每次绘制确定一次
+enum BLEND_MODE {
+    BLEND_MODE_OPAQUE,      // 直接覆盖，不读取已有的颜色
+    BLEND_MODE_ALPHA,       // alpha_blend_state()
+    BLEND_MODE_ADDITIVE,    // additive_blend_state()
+    BLEND_MODE_GENERIC
+};
+
+inline BLEND_MODE classify_blend(const blend_state_t& state) {
+    auto same = [&](BLEND_FACTOR src, BLEND_FACTOR dst, BLEND_OP op) {
+        return state.src_color == src && state.dst_color == dst && state.color_op == op &&
+               state.src_alpha == src && state.dst_alpha == dst && state.alpha_op == op;
+    };
+    if(!state.enable || same(BLEND_ONE, BLEND_ZERO, BLEND_OP_ADD)) return BLEND_MODE_OPAQUE;
+    if(same(BLEND_SRC_ALPHA, BLEND_ONE_MINUS_SRC_ALPHA, BLEND_OP_ADD)) return BLEND_MODE_ALPHA;
+    if(same(BLEND_ONE, BLEND_ONE, BLEND_OP_ADD)) return BLEND_MODE_ADDITIVE;
+    return BLEND_MODE_GENERIC;
+}
+
+// 浮点格式的混合，channel为3时是alpha通道
+inline float blend_factor(BLEND_FACTOR factor, const vec4& src, const vec4& dst, int channel) {
+    switch(factor) {
+        case BLEND_ZERO: return 0.0f;
+        case BLEND_ONE: return 1.0f;
+        case BLEND_SRC_COLOR: return src.data()[channel];
+        case BLEND_ONE_MINUS_SRC_COLOR: return 1.0f - src.data()[channel];
+        case BLEND_DST_COLOR: return dst.data()[channel];
+        case BLEND_ONE_MINUS_DST_COLOR: return 1.0f - dst.data()[channel];
+        case BLEND_SRC_ALPHA: return src.a();
+        case BLEND_ONE_MINUS_SRC_ALPHA: return 1.0f - src.a();
+        case BLEND_DST_ALPHA: return dst.a();
+        default: return 1.0f - dst.a();
+    }
+}
+
+inline const vec4 blend_color(const blend_state_t& state, const vec4& src, const vec4& dst) {
+    vec4 result;
+    for(int c = 0; c < 4; c++) {
+        bool alpha = c == 3;
+        float s = src.data()[c], d = dst.data()[c];
+        float fs = blend_factor(alpha ? state.src_alpha : state.src_color, src, dst, c);
+        float fd = blend_factor(alpha ? state.dst_alpha : state.dst_color, src, dst, c);
+        float& r = result.data()[c];
+        switch(alpha ? state.alpha_op : state.color_op) {
+            case BLEND_OP_ADD: r = s * fs + d * fd; break;
+            case BLEND_OP_SUBTRACT: r = s * fs - d * fd; break;
+            case BLEND_OP_REVERSE_SUBTRACT: r = d * fd - s * fs; break;
+            case BLEND_OP_MIN: r = std::min(s, d); break;
+            default: r = std::max(s, d); break;
+        }
+    }
+    return result;
+}
+
+// RGBA8的混合，因子为[0, 255]的定点数，x / 255四舍五入，x <= 255 * 255
+inline uint div255(uint x) { return (x + 128 + ((x + 128) >> 8)) >> 8; }
+
+inline uint blend_factor_rgba8(BLEND_FACTOR factor, uint src, uint dst, int channel) {
+    uint s = (src >> (channel * 8)) & 0xff, d = (dst >> (channel * 8)) & 0xff;
+    switch(factor) {
+        case BLEND_ZERO: return 0;
+        case BLEND_ONE: return 255;
+        case BLEND_SRC_COLOR: return s;
+        case BLEND_ONE_MINUS_SRC_COLOR: return 255 - s;
+        case BLEND_DST_COLOR: return d;
+        case BLEND_ONE_MINUS_DST_COLOR: return 255 - d;
+        case BLEND_SRC_ALPHA: return src >> 24;
+        case BLEND_ONE_MINUS_SRC_ALPHA: return 255 - (src >> 24);
+        case BLEND_DST_ALPHA: return dst >> 24;
+        default: return 255 - (dst >> 24);
+    }
+}
+
+inline uint blend_rgba8(const blend_state_t& state, uint src, uint dst) {
+    uint result = 0;
+    for(int c = 0; c < 4; c++) {
+        bool alpha = c == 3;
+        int s = (src >> (c * 8)) & 0xff, d = (dst >> (c * 8)) & 0xff;
+        int fs = blend_factor_rgba8(alpha ? state.src_alpha : state.src_color, src, dst, c);
+        int fd = blend_factor_rgba8(alpha ? state.dst_alpha : state.dst_color, src, dst, c);
+        int r;
+        switch(alpha ? state.alpha_op : state.color_op) {
+            case BLEND_OP_ADD: r = s * fs + d * fd; break;
+            case BLEND_OP_SUBTRACT: r = s * fs - d * fd; break;
+            case BLEND_OP_REVERSE_SUBTRACT: r = d * fd - s * fs; break;
+            case BLEND_OP_MIN: r = std::min(s, d) * 255; break;
+            default: r = std::max(s, d) * 255; break;
+        }
+        result |= div255(std::min(std::max(r, 0), 255 * 255)) << (c * 8);
+    }
+    return result;
+}
+
+// 在一个32位整数中同时处理4个通道（SWAR），结果与blend_rgba8完全相同。
+// R/B和G/A各占16位的一半，乘积不超过255 * 255，不会进位到相邻的通道
+inline uint blend_rgba8_alpha(uint src, uint dst) {
+    uint a = src >> 24, ia = 255 - a;
+    uint rb = (src & 0x00ff00ff) * a + (dst & 0x00ff00ff) * ia + 0x00800080;
+    uint ag = ((src >> 8) & 0x00ff00ff) * a + ((dst >> 8) & 0x00ff00ff) * ia + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return rb | ag;
+}
+
+// 逐字节饱和加法
+inline uint blend_rgba8_additive(uint src, uint dst) {
+    uint sum = (src & 0x7f7f7f7f) + (dst & 0x7f7f7f7f);
+    sum ^= (src ^ dst) & 0x80808080;
+    uint carry = ((src & dst) | ((src | dst) & ~sum)) & 0x80808080;
+    return sum | ((carry >> 7) * 0xff);
+}
+
+inline bool stencil_test(const stencil_state_t& state, uchar stencil) {
+    return compare<int>(state.func, state.ref & state.read_mask, stencil & state.read_mask);
+}
+
+// 按op更新模板值，只修改write_mask中的位
+inline void update_stencil(const stencil_state_t& state, STENCIL_OP op, uchar& stencil) {
+    int value = stencil;
+    switch(op) {
+        case STENCIL_OP_KEEP: return ;
+        case STENCIL_OP_ZERO: value = 0; break;
+        case STENCIL_OP_REPLACE: value = state.ref; break;
+        case STENCIL_OP_INVERT: value = ~value; break;
+        case STENCIL_OP_INCR: value = std::min(value + 1, 255); break;
+        case STENCIL_OP_DECR: value = std::max(value - 1, 0); break;
+        case STENCIL_OP_INCR_WRAP: value = value + 1; break;
+        case STENCIL_OP_DECR_WRAP: value = value - 1; break;
+    }
+    stencil = (stencil & ~state.write_mask) | (value & state.write_mask);
+}
+
+
+// 逐fragment的模板/深度测试和写入（混合、MRT、OIT），三角形、直线和点的光栅化共用，每次绘制建立一次。
+// 深度测试的时机：fragment不会discard也不修改深度时为early Z，在fragment之前完成模板、深度测试和写入；
+// 否则为late Z，在fragment之后测试和写入，被discard的fragment不修改模板。
+// late Z时仍先只读地测试一次：失败后对应的模板操作为KEEP的采样点不会改变任何东西，可以直接剔除；
+// fragment修改深度时无法预先判断
+template <class Program>
+struct fragment_output_t {
+    framebuffer_t* framebuffer;
+    Program& program;
+    int num_samples;
+    DEPTH_FORMAT depth_format;
+    COLOR_FORMAT color_format;
+    int color_size;
+    const stencil_state_t& stencil;
+    bool use_stencil;
+    const blend_state_t& blend;
+    BLEND_MODE blend_mode;
+    bool use_oit;
+    // 额外的输出写入对应的颜色附件（MRT），第0个输出使用color_rows
+    int num_outputs;
+    COLOR_FORMAT output_formats[max_num_of_outputs];
+    int output_sizes[max_num_of_outputs];
+    bool writes_depth, early_z;
+    COMPARE_FUNC depth_func;
+    bool write_depth;
+    // z / w到深度的变换，z * 0.5 + 0.5与(z + 1) * 0.5的结果完全相同
+    float depth_scale, depth_bias;
+
+    // 两行的深度、颜色和模板行指针，由fetch_rows取得，之后只用行号r和x索引
+    void* depth_rows[2][max_num_of_samples];
+    uchar* color_rows[2][max_num_of_samples];
+    uchar* stencil_rows[2][max_num_of_samples];
+    uchar* output_rows[max_num_of_outputs][2][max_num_of_samples];
+
+    // 在program.prepare()之后建立
+    fragment_output_t(framebuffer_t* _framebuffer, Program& _program, const render_state_t& state)
+        : framebuffer(_framebuffer),
+          program(_program),
+          num_samples(_framebuffer->get_num_samples()),
+          depth_format(_framebuffer->get_depth_format()),
+          color_format(_framebuffer->get_color_format()),
+          color_size(get_color_format_size(color_format)),
+          stencil(state.stencil),
+          use_stencil(state.stencil.enable && _framebuffer->has_stencil()),
+          blend(state.blend),
+          blend_mode(classify_blend(state.blend)),
+          use_oit(state.oit),
+          num_outputs(std::min(_program.get_num_outputs(), _framebuffer->get_num_color_attachments())),
+          writes_depth(_program.writes_depth()),
+          early_z(!_program.may_discard() && !writes_depth),
+          depth_func(state.depth.func),
+          write_depth(state.depth.write && !state.oit),
+          depth_scale(state.depth.zero_to_one ? 1.0f : 0.5f),
+          depth_bias(state.depth.zero_to_one ? 0.0f : 0.5f) {
+        for(int i = 1; i < num_outputs; i++) {
+            output_formats[i] = framebuffer->get_attachment_format(i);
+            output_sizes[i] = get_color_format_size(output_formats[i]);
+        }
+    }
+
+    // 取得从y0开始的num_rows行，[x0, x1]之外的像素不能访问
+    void fetch_rows(int y0, int x0, int x1, int num_rows = 2) {
+        for(int r = 0; r < num_rows && y0 + r < framebuffer->get_height(); r++) {
+            for(int s = 0; s < num_samples; s++) {
+                depth_rows[r][s] = framebuffer->get_depth_row(y0 + r, x0, x1, s);
+                color_rows[r][s] = (uchar*)framebuffer->get_color_row(y0 + r, x0, x1, s);
+                stencil_rows[r][s] = framebuffer->get_stencil_row(y0 + r, s);
+                for(int i = 1; i < num_outputs; i++) {
+                    output_rows[i][r][s] = (uchar*)framebuffer->get_attachment_row(i, y0 + r, s);
+                }
+            }
+        }
+    }
+
+    // 完整的模板和深度测试，执行模板操作，通过时写入深度
+    bool test(int r, int s, int x, float depth) {
+        if(use_stencil) {
+            uchar& value = stencil_rows[r][s][x];
+            if(!stencil_test(stencil, value)) {
+                update_stencil(stencil, stencil.fail_op, value);
+                return false;
+            }
+            if(!depth_test(depth_func, depth_format, depth_rows[r][s], x, depth)) {
+                update_stencil(stencil, stencil.depth_fail_op, value);
+                return false;
+            }
+            update_stencil(stencil, stencil.pass_op, value);
+        } else if(!depth_test(depth_func, depth_format, depth_rows[r][s], x, depth)) {
+            return false;
+        }
+        if(write_depth) store_depth(depth_format, depth_rows[r][s], x, depth);
+        return true;
+    }
+
+    // 不修改缓冲，返回采样点在fragment之后是否可能改变模板或通过测试
+    bool may_pass(int r, int s, int x, float depth) const {
+        if(use_stencil) {
+            if(!stencil_test(stencil, stencil_rows[r][s][x])) return stencil.fail_op != STENCIL_OP_KEEP;
+            if(!depth_test(depth_func, depth_format, depth_rows[r][s], x, depth)) return stencil.depth_fail_op != STENCIL_OP_KEEP;
+            return true;
+        }
+        return depth_test(depth_func, depth_format, depth_rows[r][s], x, depth);
+    }
+
+    // fragment之前：early Z时完成测试，否则只剔除，返回剩下的采样点。depth为各采样点的深度
+    int test_before(int r, int x, int samples, const float* depth) {
+        if(writes_depth) return samples;
+        for(int s = 0; s < num_samples; s++) {
+            if(!(samples >> s & 1)) continue;
+            bool pass = early_z ? test(r, s, x, depth[s]) : may_pass(r, s, x, depth[s]);
+            if(!pass) samples &= ~(1 << s);
+        }
+        return samples;
+    }
+
+    // fragment之后：late Z时完成测试，然后把color和额外的输出写入通过测试的采样点，同一个颜色写入所有采样点。
+    // center_depth为像素中心的深度，只用于OIT
+    void write(int r, int x, int y, const vec4& color, int samples, const float* depth, float center_depth) {
+        if(!early_z) {
+            // 修改了深度时所有采样点使用同一个深度
+            float fragment_depth = writes_depth ? program.get_depth_output() : 0.0f;
+            for(int s = 0; s < num_samples; s++) {
+                if(!(samples >> s & 1)) continue;
+                if(!test(r, s, x, writes_depth ? fragment_depth : depth[s])) samples &= ~(1 << s);
+            }
+            if(!samples) return ;
+            if(writes_depth) center_depth = fragment_depth;
+        }
+
+        // OIT：插入链表，由resolve_oit排序后混合
+        if(use_oit) {
+            framebuffer->insert_oit_fragment(x, y, center_depth, color, samples);
+            return ;
+        }
+
+        uint value[max_num_of_outputs][4];
+        encode_color(color_format, color, value[0]);
+        for(int i = 1; i < num_outputs; i++) {
+            encode_color(output_formats[i], program.get_output(i), value[i]);
+        }
+        for(int s = 0; s < num_samples; s++) {
+            if(!(samples >> s & 1)) continue;
+            uchar* dst = color_rows[r][s] + x * color_size;
+            if(blend_mode == BLEND_MODE_OPAQUE) {
+                store_color(dst, value[0], color_size);
+            } else if(color_format == COLOR_FORMAT_RGBA8) {
+                uint& pixel = *(uint*)dst;
+                switch(blend_mode) {
+                    case BLEND_MODE_ALPHA: pixel = blend_rgba8_alpha(value[0][0], pixel); break;
+                    case BLEND_MODE_ADDITIVE: pixel = blend_rgba8_additive(value[0][0], pixel); break;
+                    default: pixel = blend_rgba8(blend, value[0][0], pixel); break;
+                }
+            } else {
+                uint blended[4];
+                encode_color(color_format, blend_color(blend, color, decode_color(color_format, dst)), blended);
+                store_color(dst, blended, color_size);
+            }
+            for(int i = 1; i < num_outputs; i++) {
+                store_color(output_rows[i][r][s] + x * output_sizes[i], value[i], output_sizes[i]);
+            }
+        }
+    }
+};
+
+// https://www.scratchapixel.com/lessons/3d-basic-rendering/rasterization-practical-implementation/rasterization-stage
+template <class Program>
+void rasterize(const v2f_t<typename Program::varyings_t>* v2fs[3], Program& program,
+               const int* active, int num_active, fragment_output_t<Program>& output) {
+    framebuffer_t* framebuffer = output.framebuffer;
+    int width = framebuffer->get_width();
+    int height = framebuffer->get_height();
+
+    // 多重采样：覆盖和深度按采样点计算，fragment shader每个像素只执行一次
+    int num_samples = output.num_samples;
+    const int* sample_x;
+    const int* sample_y;
+    get_sample_pattern(num_samples, sample_x, sample_y);
+    int full_coverage = (1 << num_samples) - 1;
+    // 单采样时sub = 1，顶点取整到像素中心，与原来的行为一致
+    int sub = num_samples > 1 ? subpixel_scale : 1;
+    int margin = num_samples > 1 ? max_sample_offset : 0;
+    float sample_fx[max_num_of_samples], sample_fy[max_num_of_samples];
+    for(int s = 0; s < num_samples; s++) {
+        sample_fx[s] = sample_x[s] / (float)sub;
+        sample_fy[s] = sample_y[s] / (float)sub;
+    }
+
+    mat4 viewport_mat = viewport(width, height);
+
+    float one_div_w[3];
+    vec4 p[3];
+    // 以1/sub像素为单位
+    vec2i v[3];
+
+    for(int i = 0; i < 3; i++) {
+        one_div_w[i] = 1.0f / v2fs[i]->position.w();
+        p[i] = viewport_mat.mul_vec4(v2fs[i]->position * one_div_w[i]);
+        v[i] = vec2i(p[i].x() * sub, p[i].y() * sub);
+    }
+
+    vec2i edge0 = v[2] - v[1];
+    vec2i edge1 = v[0] - v[2];
+    vec2i edge2 = v[1] - v[0];
+
+
+    int area = edge_function(v[0], v[1], v[2]);
+    if(area == 0) return ;
+
+    // 背面剔除
+    int backface = sgn(area);
+    if(backface < 0) return ;
+
+    // 包含可能被覆盖的采样点的像素
+    bbox_t bbox = calc_bbox(v[0], v[1], v[2]);
+    bbox.xl = std::max(ceil_div(bbox.xl - margin, sub), 0);
+    bbox.yl = std::max(ceil_div(bbox.yl - margin, sub), 0);
+    bbox.xr = std::min(floor_div(bbox.xr + margin, sub), width - 1);
+    bbox.yr = std::min(floor_div(bbox.yr + margin, sub), height - 1);
+
+    // If the point is on the edge, test if it is a top or left edge,
+    // otherwise test if  the edge function is ok
+    auto inside = [](int d, const vec2i& edge) {
+        return d == 0 ? ((edge.y == 0 && edge.x < 0) || edge.y < 0) : d > 0;
+    };
+
+    // 返回像素(x, y)中被覆盖的采样点的mask
+    auto coverage = [&](int x, int y) {
+        vec2i P(x * sub, y * sub);
+        int da = edge_function(v[1], v[2], P);
+        int db = edge_function(v[2], v[0], P);
+        int dc = edge_function(v[0], v[1], P);
+        if(num_samples == 1) {
+            return (inside(da, edge0) && inside(db, edge1) && inside(dc, edge2)) ? 1 : 0;
+        }
+        // 采样点离像素中心最多margin，像素中心离三条边都足够远时所有采样点的结果相同，
+        // 只有边缘上的像素需要逐个采样点测试
+        int ra = margin * (abs(edge0.x) + abs(edge0.y));
+        int rb = margin * (abs(edge1.x) + abs(edge1.y));
+        int rc = margin * (abs(edge2.x) + abs(edge2.y));
+        if(da > ra && db > rb && dc > rc) return full_coverage;
+        if(da < -ra || db < -rb || dc < -rc) return 0;
+        int mask = 0;
+        for(int s = 0; s < num_samples; s++) {
+            int ox = sample_x[s], oy = sample_y[s];
+            if(inside(da - edge0.y * ox + edge0.x * oy, edge0) &&
+               inside(db - edge1.y * ox + edge1.x * oy, edge1) &&
+               inside(dc - edge2.y * ox + edge2.x * oy, edge2)) {
+                mask |= 1 << s;
+            }
+        }
+        return mask;
+    };
+
+    // 每个三角形只建立一次平面方程 f(x, y) = f0 + dx * (x - x0) + dy * (y - y0)，(x0, y0)为v[0]。
+    // 深度在屏幕空间是线性的；varying乘以1/w后是线性的，逐像素只需要几次乘加再乘以w。
+    // 只有active中列出的float（fragment会读取的）建立平面方程并插值
+    typedef typename Program::varyings_t varyings_t;
+    const int max_floats = num_floats_of<varyings_t>::capacity;
+
+    // 重心坐标对x, y（以像素为单位）的偏导
+    float alpha_dx = -edge0.y * sub / (float)area, alpha_dy = edge0.x * sub / (float)area;
+    float beta_dx  = -edge1.y * sub / (float)area, beta_dy  = edge1.x * sub / (float)area;
+    float gamma_dx = -edge2.y * sub / (float)area, gamma_dy = edge2.x * sub / (float)area;
+    float origin_x = v[0].x / (float)sub, origin_y = v[0].y / (float)sub;
+
+    auto setup_plane = [&](float f0, float f1, float f2, float& c, float& dx, float& dy) {
+        c = f0;
+        dx = alpha_dx * f0 + beta_dx * f1 + gamma_dx * f2;
+        dy = alpha_dy * f0 + beta_dy * f1 + gamma_dy * f2;
+    };
+
+    float z_c, z_dx, z_dy;
+    float w_c, w_dx, w_dy;
+    setup_plane(p[0].z(), p[1].z(), p[2].z(), z_c, z_dx, z_dy);
+    setup_plane(one_div_w[0], one_div_w[1], one_div_w[2], w_c, w_dx, w_dy);
+    float depth_scale = output.depth_scale, depth_bias = output.depth_bias;
+
+    float plane_c[max_floats], plane_dx[max_floats], plane_dy[max_floats];
+    const float* va = v2fs[0]->data();
+    const float* vb = v2fs[1]->data();
+    const float* vc = v2fs[2]->data();
+    for(int k = 0; k < num_active; k++) {
+        int i = active[k];
+        setup_plane(va[i] * one_div_w[0], vb[i] * one_div_w[1], vc[i] * one_div_w[2],
+                    plane_c[k], plane_dx[k], plane_dy[k]);
+    }
+
+    // 以2x2的quad为单位着色，lane的顺序为(x0, y0), (x0 + 1, y0), (x0, y0 + 1), (x0 + 1, y0 + 1)。
+    // mask中为1的lane是需要写入的像素，其余lane作为helper参与插值，用来计算屏幕空间导数
+    varyings_t quad[4];
+    varyings_t dfdx, dfdy;
+    float* dfdx_data = (float*)&dfdx;
+    float* dfdy_data = (float*)&dfdy;
+    if(num_active < num_floats_of<varyings_t>::value) {
+        // 没有插值的varying统一置0，避免读到上一个像素的值
+        memset((void*)quad, 0, sizeof(quad));
+        memset((void*)&dfdx, 0, sizeof(dfdx));
+        memset((void*)&dfdy, 0, sizeof(dfdy));
+    }
+
+    // samples[lane]为该像素被覆盖的采样点，为0的lane只作为helper
+    auto shade_quad = [&](int x0, int y0, int samples[4]) {
+        float dx = x0 - origin_x, dy = y0 - origin_y;
+        float depth[4][max_num_of_samples] = {};
+        int mask = 0;
+        for(int lane = 0; lane < 4; lane++) {
+            if(!samples[lane]) continue;
+            float lx = dx + (lane & 1), ly = dy + (lane >> 1);
+            for(int s = 0; s < num_samples; s++) {
+                if(!(samples[lane] >> s & 1)) continue;
+                float z = z_c + z_dx * (lx + sample_fx[s]) + z_dy * (ly + sample_fy[s]);
+                depth[lane][s] = z * depth_scale + depth_bias;
+            }
+            samples[lane] = output.test_before(lane >> 1, x0 + (lane & 1), samples[lane], depth[lane]);
+            if(samples[lane]) mask |= 1 << lane;
+        }
+        if(!mask) return ;
+
+        if(num_active) {
+            // 透视矫正插值，helper lane在三角形外，相当于外插
+            for(int lane = 0; lane < 4; lane++) {
+                float lx = dx + (lane & 1), ly = dy + (lane >> 1);
+                float w = 1.0f / (w_c + w_dx * lx + w_dy * ly);
+                float* data = (float*)&quad[lane];
+                for(int k = 0; k < num_active; k++) {
+                    data[active[k]] = (plane_c[k] + plane_dx[k] * lx + plane_dy[k] * ly) * w;
+                }
+            }
+
+            // 整个quad共用一组导数
+            const float* v00 = (const float*)&quad[0];
+            const float* v10 = (const float*)&quad[1];
+            const float* v01 = (const float*)&quad[2];
+            for(int k = 0; k < num_active; k++) {
+                int i = active[k];
+                dfdx_data[i] = v10[i] - v00[i];
+                dfdy_data[i] = v01[i] - v00[i];
+            }
+        }
+        program.set_derivatives(&dfdx, &dfdy);
+
+        for(int lane = 0; lane < 4; lane++) {
+            if(!(mask & (1 << lane))) continue;
+
+            // fragment shader
+            bool discord = false;
+            vec4 color = program.fragment(quad[lane], discord);
+            if(discord) continue;
+
+            float lx = dx + (lane & 1), ly = dy + (lane >> 1);
+            float center_depth = output.use_oit ? (z_c + z_dx * lx + z_dy * ly) * depth_scale + depth_bias : 0.0f;
+            output.write(lane >> 1, x0 + (lane & 1), y0 + (lane >> 1), color, samples[lane], depth[lane], center_depth);
+        }
+    };
+
+    for(int i = bbox.yl & ~1; i <= bbox.yr; i += 2) {
+        output.fetch_rows(i, bbox.xl, bbox.xr);
+        for(int j = bbox.xl & ~1; j <= bbox.xr; j += 2) {
+            int samples[4] = {0, 0, 0, 0};
+            bool any = false;
+            for(int lane = 0; lane < 4; lane++) {
+                int x = j + (lane & 1), y = i + (lane >> 1);
+                if(x < bbox.xl || x > bbox.xr || y < bbox.yl || y > bbox.yr) continue;
+                samples[lane] = coverage(x, y);
+                any |= samples[lane] != 0;
+            }
+            if(any) shade_quad(j, i, samples);
+        }
+    }
+    program.set_derivatives(NULL, NULL);
+}
+
+// 与rasterize相同地把屏幕坐标取整到1/sub像素，再取最近的像素中心，线和点与三角形对齐
+inline int snap_to_pixel(float coord, int sub) { return floor_div((int)floor(coord * sub + 0.5f) + sub / 2, sub); }
+
+// 直线：Bresenham确定经过的像素，沿主轴的参数t（DDA）插值深度和active中的varying，每个像素的所有采样点都写入。
+// 不画最后一个像素，LINE_STRIP和线框中相连的线段不会重复混合。没有quad，屏幕空间导数为0
+template <class Program>
+void rasterize_line(const v2f_t<typename Program::varyings_t>* v2fs[2], Program& program,
+                    const int* active, int num_active, fragment_output_t<Program>& output) {
+    framebuffer_t* framebuffer = output.framebuffer;
+    int width = framebuffer->get_width();
+    int height = framebuffer->get_height();
+    mat4 viewport_mat = viewport(width, height);
+
+    // 裁剪后端点在[0, width] x [0, height]内
+    int sub = output.num_samples > 1 ? subpixel_scale : 1;
+    float one_div_w[2];
+    vec4 p[2];
+    int px[2], py[2];
+    for(int i = 0; i < 2; i++) {
+        one_div_w[i] = 1.0f / v2fs[i]->position.w();
+        p[i] = viewport_mat.mul_vec4(v2fs[i]->position * one_div_w[i]);
+        px[i] = std::min(std::max(snap_to_pixel(p[i].x(), sub), 0), width - 1);
+        py[i] = std::min(std::max(snap_to_pixel(p[i].y(), sub), 0), height - 1);
+    }
+    int adx = abs(px[1] - px[0]), ady = abs(py[1] - py[0]);
+    int steps = std::max(adx, ady);
+    if(steps == 0) return ;
+
+    typedef typename Program::varyings_t varyings_t;
+    varyings_t varyings, zero;
+    memset((void*)&varyings, 0, sizeof(varyings));
+    memset((void*)&zero, 0, sizeof(zero));
+    program.set_derivatives(&zero, &zero);
+
+    const float* va = v2fs[0]->data();
+    const float* vb = v2fs[1]->data();
+    float* data = (float*)&varyings;
+    int full_coverage = (1 << output.num_samples) - 1;
+    float depth[max_num_of_samples];
+
+    int sx = px[1] > px[0] ? 1 : -1, sy = py[1] > py[0] ? 1 : -1;
+    int err = adx - ady;
+    int x = px[0], y = py[0];
+    // 换行时才取行指针，范围到线段的终点，这一行之后的像素都在其中
+    int row = -1;
+    for(int i = 0; i < steps; i++) {
+        float t = i / (float)steps;
+        float z = p[0].z() + (p[1].z() - p[0].z()) * t;
+        float d = z * output.depth_scale + output.depth_bias;
+        for(int s = 0; s < output.num_samples; s++) depth[s] = d;
+
+        if(y != row) {
+            output.fetch_rows(y, std::min(x, px[1]), std::max(x, px[1]), 1);
+            row = y;
+        }
+        int samples = output.test_before(0, x, full_coverage, depth);
+        if(samples) {
+            if(num_floats_of<varyings_t>::value && num_active) {
+                // varying / w和1 / w在屏幕空间是线性的
+                float w0 = one_div_w[0] * (1.0f - t), w1 = one_div_w[1] * t;
+                float w = 1.0f / (w0 + w1);
+                for(int k = 0; k < num_active; k++) {
+                    int j = active[k];
+                    data[j] = (va[j] * w0 + vb[j] * w1) * w;
+                }
+            }
+            bool discard = false;
+            vec4 color = program.fragment(varyings, discard);
+            if(!discard) output.write(0, x, y, color, samples, depth, d);
+        }
+
+        int e2 = 2 * err;
+        if(e2 > -ady) {
+            err -= ady;
+            x += sx;
+        }
+        if(e2 < adx) {
+            err += adx;
+            y += sy;
+        }
+    }
+    program.set_derivatives(NULL, NULL);
+}
+
+// 点：一个像素，varying不需要插值，屏幕空间导数为0
+template <class Program>
+void rasterize_point(const v2f_t<typename Program::varyings_t>* v2f, Program& program, fragment_output_t<Program>& output) {
+    framebuffer_t* framebuffer = output.framebuffer;
+    int width = framebuffer->get_width();
+    int height = framebuffer->get_height();
+    vec4 p = viewport(width, height).mul_vec4(v2f->position * (1.0f / v2f->position.w()));
+    int sub = output.num_samples > 1 ? subpixel_scale : 1;
+    int x = snap_to_pixel(p.x(), sub), y = snap_to_pixel(p.y(), sub);
+    if(x < 0 || x >= width || y < 0 || y >= height) return ;
+
+    float d = p.z() * output.depth_scale + output.depth_bias;
+    float depth[max_num_of_samples];
+    for(int s = 0; s < output.num_samples; s++) depth[s] = d;
+    output.fetch_rows(y, x, x, 1);
+    int samples = output.test_before(0, x, (1 << output.num_samples) - 1, depth);
+    if(!samples) return ;
+
+    typename Program::varyings_t zero;
+    memset((void*)&zero, 0, sizeof(zero));
+    program.set_derivatives(&zero, &zero);
+    bool discard = false;
+    vec4 color = program.fragment(v2f->varyings, discard);
+    program.set_derivatives(NULL, NULL);
+    if(!discard) output.write(0, x, y, color, samples, depth, d);
+}
+
+// 只写深度的光栅化，用于shadow map和depth prepass：不插值varying、不执行fragment shader、不写颜色。
+// 覆盖规则与rasterize相同，边函数按行增量计算；深度平面的建立和逐像素的求值也与rasterize相同，
+// 写入的深度与draw_primitives逐位相同，第二遍可以用COMPARE_EQUAL
+template <class Varyings>
+void rasterize_depth(framebuffer_t* framebuffer, const v2f_t<Varyings>* v2fs[3], const depth_state_t& state) {
+    int width = framebuffer->get_width();
+    int height = framebuffer->get_height();
+
+    mat4 viewport_mat = viewport(width, height);
+
+    vec4 p[3];
+    vec2i v[3];
+    for(int i = 0; i < 3; i++) {
+        p[i] = viewport_mat.mul_vec4(v2fs[i]->position * (1.0f / v2fs[i]->position.w()));
+        v[i] = vec2i(p[i].x(), p[i].y());
+    }
+
+    vec2i edge0 = v[2] - v[1];
+    vec2i edge1 = v[0] - v[2];
+    vec2i edge2 = v[1] - v[0];
+
+    int area = edge_function(v[0], v[1], v[2]);
+    // 与rasterize一样剔除背面
+    if(area <= 0) return ;
+
+    bbox_t bbox = calc_bbox(v[0], v[1], v[2]);
+    bbox.xl = std::max(bbox.xl, 0);
+    bbox.yl = std::max(bbox.yl, 0);
+    bbox.xr = std::min(bbox.xr, width - 1);
+    bbox.yr = std::min(bbox.yr, height - 1);
+    if(bbox.xl > bbox.xr || bbox.yl > bbox.yr) return ;
+
+    // 边函数沿x增加-edge.y，沿y增加edge.x。落在边上的像素只属于top-left边，
+    // 非top-left边的偏置为-1，这样覆盖条件统一为e + bias >= 0
+    const vec2i* edges[3] = {&edge0, &edge1, &edge2};
+    const vec2i* starts[3] = {&v[1], &v[2], &v[0]};
+    int e_dx[3], e_dy[3], e_row[3], bias[3];
+    vec2i origin(bbox.xl, bbox.yl);
+    for(int k = 0; k < 3; k++) {
+        const vec2i& e = *edges[k];
+        e_dx[k] = -e.y;
+        e_dy[k] = e.x;
+        e_row[k] = edge_function(*starts[k], *starts[k] + e, origin);
+        bias[k] = ((e.y == 0 && e.x < 0) || e.y < 0) ? 0 : -1;
+    }
+
+    // 深度平面，计算顺序与rasterize（单采样时sub = 1）相同
+    float z_c = p[0].z();
+    float z_dx = (-edge0.y / (float)area) * p[0].z() + (-edge1.y / (float)area) * p[1].z() + (-edge2.y / (float)area) * p[2].z();
+    float z_dy = (edge0.x / (float)area) * p[0].z() + (edge1.x / (float)area) * p[1].z() + (edge2.x / (float)area) * p[2].z();
+    float depth_scale = state.zero_to_one ? 1.0f : 0.5f;
+    float depth_bias = state.zero_to_one ? 0.0f : 0.5f;
+
+    DEPTH_FORMAT format = framebuffer->get_depth_format();
+    for(int y = bbox.yl; y <= bbox.yr; y++) {
+        int e0 = e_row[0] + bias[0], e1 = e_row[1] + bias[1], e2 = e_row[2] + bias[2];
+        float ly = (float)(y - v[0].y);
+        void* row = framebuffer->get_depth_row(y, bbox.xl, bbox.xr);
+        // 按深度格式展开内循环，比较编码后的值
+        auto scan = [&](auto* data, auto encode) {
+            for(int x = bbox.xl; x <= bbox.xr; x++) {
+                float lx = (float)(x - v[0].x);
+                auto value = encode((z_c + z_dx * lx + z_dy * ly) * depth_scale + depth_bias);
+                if((e0 | e1 | e2) >= 0 && compare(state.func, value, data[x])) {
+                    if(state.write) data[x] = value;
+                }
+                e0 += e_dx[0];
+                e1 += e_dx[1];
+                e2 += e_dx[2];
+            }
+        };
+        switch(format) {
+            case DEPTH_FORMAT_D16: scan((ushort*)row, encode_depth16); break;
+            case DEPTH_FORMAT_D24: scan((uint*)row, encode_depth24); break;
+            default: scan((float*)row, [](float d) { return d; }); break;
+        }
+        for(int k = 0; k < 3; k++) e_row[k] += e_dy[k];
+    }
+}
+
+// 图元装配：按拓扑把第i个索引（indices为NULL时就是i）组成图元，每个图元调用一次emit(verts)。
+// 遇到primitive_restart_index时丢弃还没有完成的图元，之后的索引开始新的strip/fan
+template <class Emit>
+void assemble_primitives(PRIMITIVE_TYPE type, const ibo_t* indices, int count, const Emit& emit) {
+    int size = type == POINTS ? 1 : (type == LINES || type == LINE_STRIP) ? 2 : 3;
+    int verts[3];
+    int num = 0;
+    bool odd = false;
+    for(int i = 0; i < count; i++) {
+        uint index = indices ? indices->at(i) : (uint)i;
+        if(index == primitive_restart_index) {
+            num = 0;
+            odd = false;
+            continue;
+        }
+        verts[num++] = (int)index;
+        if(num < size) continue;
+        switch(type) {
+            case TRIANGLE_STRIP:
+                if(odd) {
+                    int swapped[3] = {verts[1], verts[0], verts[2]};
+                    emit(swapped);
+                } else {
+                    emit(verts);
+                }
+                verts[0] = verts[1];
+                verts[1] = verts[2];
+                num = 2;
+                odd = !odd;
+                break;
+            case TRIANGLE_FAN:
+                emit(verts);
+                verts[1] = verts[2];
+                num = 2;
+                break;
+            case LINE_STRIP:
+                emit(verts);
+                verts[0] = verts[1];
+                num = 1;
+                break;
+            default:
+                emit(verts);
+                num = 0;
+                break;
+        }
+    }
+}
+
+// 变换后的顶点缓存，按顶点编号直接映射。strip、fan和索引绘制中相邻图元共用的顶点只执行一次vertex shader；
+// 不共用顶点的列表不经过缓存，直接变换到目标位置。vertex(index, varyings)执行vertex shader并返回裁剪空间的位置
+template <class Varyings, class Vertex>
+class vertex_cache_t {
+   public:
+    typedef v2f_t<Varyings> cache_v2f_t;
+
+    vertex_cache_t(const Vertex& _vertex, int _num_floats, bool _enabled)
+        : vertex(_vertex), num_floats(_num_floats), enabled(_enabled) {
+        reset();
+    }
+
+    // 顶点的输入改变（例如切换到下一个实例）后需要清空
+    void reset() {
+        for(int i = 0; i < size; i++) tags[i] = -1;
+    }
+
+    // 第index个顶点变换后的位置和varying写入target
+    void fetch(int index, cache_v2f_t& target) {
+        if(!enabled) {
+            target.position = vertex(index, target.varyings);
+            return ;
+        }
+        int slot = index & (size - 1);
+        cache_v2f_t& entry = entries[slot];
+        if(tags[slot] != index) {
+            tags[slot] = index;
+            entry.position = vertex(index, entry.varyings);
+        }
+        target.position = entry.position;
+        if(num_floats) memcpy(target.data(), entry.data(), num_floats * sizeof(float));
+    }
+
+   private:
+    static const int size = 32;
+    const Vertex& vertex;
+    int num_floats;
+    bool enabled;
+    int tags[size];
+    cache_v2f_t entries[size];
+};
+
+// 相邻的图元是否共用顶点，共用时才需要顶点缓存
+inline bool shares_vertices(PRIMITIVE_TYPE type, const ibo_t* indices) {
+    return indices || type == TRIANGLE_STRIP || type == TRIANGLE_FAN || type == LINE_STRIP;
+}
+
+// 图元的顶点变换和裁剪：verts为装配好的顶点编号，裁剪后的每个图元调用一次emit(prim, n)，
+// n为图元的顶点个数（三角形3，直线2，点1）。v2fs为裁剪使用的临时空间
+template <class V2f, class Cache, class Emit>
+void setup_primitive(PRIMITIVE_TYPE type, const int* verts, Cache& cache, int num_floats, bool zero_to_one, V2f* v2fs,
+                     const Emit& emit) {
+    if(type == POINTS) {
+        cache.fetch(verts[0], v2fs[0]);
+        const V2f* pt_v2fs[1] = {&v2fs[0]};
+        if(clip_point(v2fs[0].position, zero_to_one)) emit(pt_v2fs, 1);
+        return ;
+    }
+
+    const V2f* ln_v2fs[2];
+    if(type == LINES || type == LINE_STRIP) {
+        // 线段只裁剪不剔除
+        cache.fetch(verts[0], v2fs[0]);
+        cache.fetch(verts[1], v2fs[1]);
+        if(clip_line(&v2fs[0], &v2fs[1], num_floats, zero_to_one, &v2fs[2], ln_v2fs)) emit(ln_v2fs, 2);
+        return ;
+    }
+
+    for(int j = 0; j < 3; j++) {
+        cache.fetch(verts[j], v2fs[j]);
+    }
+    if(type == TRIANGLE_WIRE_FRAME) {
+        // 线框：三角形的三条边分别作为直线裁剪和光栅化，只用裁剪后的多边形判断正反面
+        if(!is_front_facing(v2fs, zero_to_one)) return ;
+        for(int j = 0; j < 3; j++) {
+            if(clip_line(&v2fs[j], &v2fs[(j + 1) % 3], num_floats, zero_to_one, &v2fs[3], ln_v2fs)) emit(ln_v2fs, 2);
+        }
+        return ;
+    }
+    int indexes[3 * max_num_of_v2fs];
+    int num = clip_aganst_panels(v2fs, num_floats, indexes, zero_to_one);
+    const V2f* tr_v2fs[3];
+    for(int i = 0; i < num; i += 3) {
+        for(int j = 0; j < 3; j++) {
+            tr_v2fs[j] = &v2fs[indexes[i + j]];
+        }
+        emit(tr_v2fs, 3);
+    }
+}
+
+template <class Program>
+void rasterize_primitive(const v2f_t<typename Program::varyings_t>** v2fs, int n, Program& program,
+                         const int* active, int num_active, fragment_output_t<Program>& output) {
+    if(n == 3) {
+        rasterize(v2fs, program, active, num_active, output);
+    } else if(n == 2) {
+        rasterize_line(v2fs, program, active, num_active, output);
+    } else {
+        rasterize_point(v2fs[0], program, output);
+    }
+}
+
+// 根据shader声明的mask整理出需要插值的float下标，返回个数
+template <class Program>
+int collect_active_varyings(const Program& program, int* active) {
+    int num_active = 0;
+    varying_mask_t mask = program.get_varying_mask();
+    for(int i = 0; i < program.get_num_floats(); i++) {
+        if(i >= 64 || (mask >> i & 1)) active[num_active++] = i;
+    }
+    return num_active;
+}
+
+template <class Program>
+void draw(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, Program& program, PRIMITIVE_TYPE type,
+          const render_state_t* state) {
+    static const render_state_t default_state;
+    const render_state_t& render_state = state ? *state : default_state;
+    typedef typename Program::varyings_t varyings_t;
+    typedef v2f_t<varyings_t> program_v2f_t;
+
+    program_v2f_t v2fs[max_num_of_v2fs];
+    int num_floats = program.get_num_floats();
+
+    program.prepare();
+
+    int active[num_floats_of<varyings_t>::capacity];
+    int num_active = collect_active_varyings(program, active);
+
+    fragment_output_t<Program> output(framebuffer, program, render_state);
+    bool zero_to_one = render_state.depth.zero_to_one;
+    auto vertex = [&](int index, varyings_t& varyings) { return program.vertex(data->at(index), varyings); };
+    vertex_cache_t<varyings_t, decltype(vertex)> cache(vertex, num_floats, shares_vertices(type, indices));
+    int count = indices ? indices->get_count() : data->get_count();
+
+    assemble_primitives(type, indices, count, [&](const int* verts) {
+        setup_primitive(type, verts, cache, num_floats, zero_to_one, v2fs, [&](const program_v2f_t** prim, int n) {
+            rasterize_primitive(prim, n, program, active, num_active, output);
+        });
+    });
+}
+
+// 裁剪后的图元，依次保存每个图元的顶点和顶点个数。vertex阶段和光栅化分开执行时（实例化绘制、命令列表）使用
+template <class Varyings>
+struct primitive_list_t {
+    std::vector<v2f_t<Varyings>> v2fs;
+    std::vector<int> sizes;
+
+    void clear() {
+        v2fs.clear();
+        sizes.clear();
+    }
+
+    void reserve(int num_v2fs) {
+        v2fs.reserve(num_v2fs);
+        sizes.reserve(num_v2fs);
+    }
+};
+
+// vertex阶段：图元装配、vertex shader和裁剪，裁剪后的图元追加到list
+template <class Varyings, class Vertex>
+void process_primitives(PRIMITIVE_TYPE type, const ibo_t* indices, int count, vertex_cache_t<Varyings, Vertex>& cache,
+                        int num_floats, bool zero_to_one, primitive_list_t<Varyings>& list) {
+    typedef v2f_t<Varyings> list_v2f_t;
+    list_v2f_t v2fs[max_num_of_v2fs];
+    assemble_primitives(type, indices, count, [&](const int* verts) {
+        setup_primitive(type, verts, cache, num_floats, zero_to_one, v2fs, [&](const list_v2f_t** prim, int n) {
+            for(int j = 0; j < n; j++) list.v2fs.push_back(*prim[j]);
+            list.sizes.push_back(n);
+        });
+    });
+}
+
+// 按保存的顺序光栅化list中的图元
+template <class Program>
+void rasterize_primitives(const primitive_list_t<typename Program::varyings_t>& list, Program& program,
+                          const int* active, int num_active, fragment_output_t<Program>& output) {
+    const v2f_t<typename Program::varyings_t>* prim[3];
+    int offset = 0;
+    for(int n : list.sizes) {
+        for(int j = 0; j < n; j++) prim[j] = &list.v2fs[offset + j];
+        rasterize_primitive(prim, n, program, active, num_active, output);
+        offset += n;
+    }
+}
+
+// 实例化绘制每批大约保存的顶点数，实例很多时分批处理以限制内存
+const int max_batch_vertices = 1 << 16;
+
+// 实例化绘制：prepare和光栅化的准备只做一次。每批实例分给多个线程执行vertex shader和裁剪，
+// 图元保存在各实例的列表中，然后在当前线程按实例的顺序光栅化，结果与逐个实例绘制相同
+template <class Program>
+void draw_instanced(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, const vbo_t* instances,
+                    Program& program, PRIMITIVE_TYPE type, const render_state_t* state) {
+    static const render_state_t default_state;
+    const render_state_t& render_state = state ? *state : default_state;
+    typedef typename Program::varyings_t varyings_t;
+
+    int num_floats = program.get_num_floats();
+
+    program.prepare();
+
+    int active[num_floats_of<varyings_t>::capacity];
+    int num_active = collect_active_varyings(program, active);
+
+    fragment_output_t<Program> output(framebuffer, program, render_state);
+    bool zero_to_one = render_state.depth.zero_to_one;
+    bool shares = shares_vertices(type, indices);
+    int count = indices ? indices->get_count() : data->get_count();
+    int num_instances = instances->get_count();
+    int batch = std::max(1, std::min(max_batch_vertices / std::max(count, 1), num_instances));
+    std::vector<primitive_list_t<varyings_t>> lists(batch);
+
+    for(int first = 0; first < num_instances; first += batch) {
+        int num = std::min(batch, num_instances - first);
+        parallel_rows(num, [&](int begin, int end) {
+            const void* instance = NULL;
+            auto vertex = [&](int index, varyings_t& varyings) {
+                return program.instance_vertex(data->at(index), instance, varyings);
+            };
+            vertex_cache_t<varyings_t, decltype(vertex)> cache(vertex, num_floats, shares);
+            for(int k = begin; k < end; k++) {
+                instance = instances->at(first + k);
+                cache.reset();
+                lists[k].clear();
+                process_primitives(type, indices, count, cache, num_floats, zero_to_one, lists[k]);
+            }
+        });
+
+        for(int k = 0; k < num; k++) {
+            rasterize_primitives(lists[k], program, active, num_active, output);
+        }
+    }
+}
+
+// 命令列表中记录的一次绘制。uniform和render state在记录时复制，
+// 每个阶段开始时都把复制的uniform绑定到shader上并调用prepare，绘制之后重新绑定记录时传入的uniform
+template <class Program>
+class deferred_draw_impl_t : public deferred_draw_t {
+   public:
+    typedef typename Program::varyings_t varyings_t;
+
+    deferred_draw_impl_t(const Program& _program, shader_t* _shader, const void* _uniforms, int sizeof_uniforms,
+                         const vbo_t* _data, const ibo_t* _indices, PRIMITIVE_TYPE _type, const render_state_t* _state)
+        : program(_program),
+          shader(_shader),
+          source(_uniforms),
+          uniforms((const char*)_uniforms, (const char*)_uniforms + sizeof_uniforms),
+          data(_data),
+          indices(_indices),
+          type(_type),
+          state(_state ? *_state : render_state_t()) {}
+
+    void process_vertices() override {
+        shader->bind_uniform(uniforms.data());
+        program.prepare();
+        int num_floats = program.get_num_floats();
+        auto vertex = [&](int index, varyings_t& varyings) { return program.vertex(data->at(index), varyings); };
+        vertex_cache_t<varyings_t, decltype(vertex)> cache(vertex, num_floats, shares_vertices(type, indices));
+        int count = indices ? indices->get_count() : data->get_count();
+        list.reserve(count);
+        process_primitives(type, indices, count, cache, num_floats, state.depth.zero_to_one, list);
+    }
+
+    void rasterize(framebuffer_t* framebuffer) override {
+        // 两个阶段之间同一个shader对象可能被其他绘制绑定和prepare过
+        shader->bind_uniform(uniforms.data());
+        program.prepare();
+        int active[num_floats_of<varyings_t>::capacity];
+        int num_active = collect_active_varyings(program, active);
+        fragment_output_t<Program> output(framebuffer, program, state);
+        rasterize_primitives(list, program, active, num_active, output);
+        list.clear();
+        shader->bind_uniform((void*)source);
+    }
+
+    void execute(framebuffer_t* framebuffer) override {
+        shader->bind_uniform(uniforms.data());
+        draw(framebuffer, data, indices, program, type, &state);
+        shader->bind_uniform((void*)source);
+    }
+
+   private:
+    Program program;
+    shader_t* shader;
+    const void* source;
+    std::vector<char> uniforms;
+    const vbo_t* data;
+    const ibo_t* indices;
+    PRIMITIVE_TYPE type;
+    render_state_t state;
+    primitive_list_t<varyings_t> list;
+};
+
+// 与顺序无关的绘制：不混合、不使用OIT和模板，写入深度且深度比较为远近关系。
+// 调换两个深度比较相同的绘制只可能改变深度相同的像素
+inline bool is_order_independent(const render_state_t* state) {
+    if(!state) return true;
+    COMPARE_FUNC func = state->depth.func;
+    bool nearest = func == COMPARE_LESS || func == COMPARE_LEQUAL || func == COMPARE_GREATER || func == COMPARE_GEQUAL;
+    return !state->oit && !state->stencil.enable && state->depth.write && nearest &&
+           classify_blend(state->blend) == BLEND_MODE_OPAQUE;
+}
+
+// 只执行vertex shader和深度光栅化，fragment shader和varying都被忽略
+template <class Program>
+void draw_depth(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, Program& program, PRIMITIVE_TYPE type,
+                const render_state_t* state) {
+    static const render_state_t default_state;
+    const depth_state_t& depth_state = (state ? *state : default_state).depth;
+    typedef typename Program::varyings_t varyings_t;
+    typedef v2f_t<varyings_t> program_v2f_t;
+    assert(framebuffer->get_num_samples() == 1 && "draw_depth does not support multisampling");
+    assert((type == TRIANGLE || type == TRIANGLE_STRIP || type == TRIANGLE_FAN) && "draw_depth only draws filled triangles");
+
+    int indexes[3 * max_num_of_v2fs];
+    program_v2f_t v2fs[max_num_of_v2fs];
+
+    program.prepare();
+
+    // 裁剪时也只需要位置，缓存中不复制varying
+    auto vertex = [&](int index, varyings_t& varyings) { return program.vertex(data->at(index), varyings); };
+    vertex_cache_t<varyings_t, decltype(vertex)> cache(vertex, 0, shares_vertices(type, indices));
+    int count = indices ? indices->get_count() : data->get_count();
+    assemble_primitives(type, indices, count, [&](const int* verts) {
+        for(int j = 0; j < 3; j++) {
+            cache.fetch(verts[j], v2fs[j]);
+        }
+        int num = clip_aganst_panels(v2fs, 0, indexes, depth_state.zero_to_one);
+        const program_v2f_t* tr_v2fs[3];
+        for(int i = 0; i < num; i += 3) {
+            for(int j = 0; j < 3; j++) {
+                tr_v2fs[j] = &v2fs[indexes[i + j]];
+            }
+            rasterize_depth(framebuffer, tr_v2fs, depth_state);
+        }
+    });
+}
+
+// 模板shader：varying类型和大小在编译期确定，vertex/fragment可以内联
+template <class Shader>
+class typed_program_t {
+   public:
+    typedef typename Shader::varyings_t varyings_t;
+    typedef typename Shader::attribs_t attribs_t;
+
+    static_assert(std::is_empty<varyings_t>::value || sizeof(varyings_t) % sizeof(float) == 0,
+                  "varyings must consist of floats");
+
+    typed_program_t(Shader* _shader) : shader(_shader) {}
+
+    int get_num_floats() const { return num_floats_of<varyings_t>::value; }
+
+    varying_mask_t get_varying_mask() const { return shader->get_used_varyings(); }
+
+    int get_num_outputs() const { return shader->get_num_outputs(); }
+
+    const vec4& get_output(int index) const { return shader->get_output(index); }
+
+    bool may_discard() const { return shader->may_discard(); }
+
+    bool writes_depth() const { return shader->writes_depth(); }
+
+    float get_depth_output() const { return shader->get_depth_output(); }
+
+    void prepare() { shader->prepare(); }
+
+    void set_derivatives(const varyings_t* dfdx, const varyings_t* dfdy) {
+        shader->bind_derivatives(dfdx, dfdy);
+    }
+
+    const vec4 vertex(const void* attribs, varyings_t& varyings) {
+        return shader->vertex(*(const attribs_t*)attribs, varyings);
+    }
+
+    // 只在实例化绘制时实例化，Shader需要定义instance_attribs_t
+    const vec4 instance_vertex(const void* attribs, const void* instance, varyings_t& varyings) {
+        typedef typename Shader::instance_attribs_t instance_attribs_t;
+        return shader->vertex(*(const attribs_t*)attribs, *(const instance_attribs_t*)instance, varyings);
+    }
+
+    const vec4 fragment(const varyings_t& varyings, bool& discard) {
+        return shader->fragment(varyings, discard);
+    }
+
+   private:
+    Shader* shader;
+};
+}  // namespace render
+
+template <class Shader>
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, typename type_identity<Shader>::type* shader, PRIMITIVE_TYPE type,
+                     const render_state_t* state) {
+    assert(framebuffer && data && shader);
+    assert(sizeof(typename Shader::attribs_t) == data->get_sizeof_element());
+    render::typed_program_t<Shader> program(shader);
+    render::draw(framebuffer, data, NULL, program, type, state);
+}
+
+template <class Shader>
+void draw_primitives(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, typename type_identity<Shader>::type* shader,
+                     PRIMITIVE_TYPE type, const render_state_t* state) {
+    assert(framebuffer && data && indices && shader);
+    assert(sizeof(typename Shader::attribs_t) == data->get_sizeof_element());
+    render::typed_program_t<Shader> program(shader);
+    render::draw(framebuffer, data, indices, program, type, state);
+}
+
+template <class Shader>
+void command_list_t::draw(const vbo_t* data, const ibo_t* indices, typename type_identity<Shader>::type* shader,
+                          const void* uniforms, int sizeof_uniforms, PRIMITIVE_TYPE type, const render_state_t* state) {
+    assert(data && shader && uniforms);
+    assert(sizeof(typename Shader::attribs_t) == data->get_sizeof_element());
+    render::typed_program_t<Shader> program(shader);
+    record(new render::deferred_draw_impl_t<render::typed_program_t<Shader>>(program, shader, uniforms, sizeof_uniforms, data,
+                                                                            indices, type, state),
+           shader, data, state);
+}
+
+template <class Shader>
+void draw_primitives_instanced(framebuffer_t* framebuffer, const vbo_t* data, const ibo_t* indices, const vbo_t* instances,
+                               typename type_identity<Shader>::type* shader, PRIMITIVE_TYPE type, const render_state_t* state) {
+    assert(framebuffer && data && instances && shader);
+    assert(sizeof(typename Shader::attribs_t) == data->get_sizeof_element());
+    assert(sizeof(typename Shader::instance_attribs_t) == instances->get_sizeof_element());
+    render::typed_program_t<Shader> program(shader);
+    render::draw_instanced(framebuffer, data, indices, instances, program, type, state);
+}
+
+#endif  // RASTERIZER_PIPELINE_H_
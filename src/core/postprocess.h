@@ -0,0 +1,48 @@
+#ifndef RASTERIZER_POSTPROCESS_H_
+#define RASTERIZER_POSTPROCESS_H_
+
+#include <mutex>
+#include <vector>
+
+#include "graphics.h"
+
+// FXAA风格的屏幕空间抗锯齿，直接处理framebuffer的RGBA8颜色缓冲（多重采样时为resolve后的结果）。
+// 先算出整帧的亮度，再沿检测到的边缘搜索端点，按到端点的距离和子像素对比度与边缘另一侧的像素混合。
+// 不拷贝整帧颜色：每行修改的像素先记下来，处理完下一行再写回，混合时读到的总是原始颜色。
+// 按行分块在ThreadPool上并行，调用线程也参与计算
+class fxaa_t {
+   public:
+    fxaa_t();
+
+    fxaa_t(const fxaa_t&) = delete;
+    fxaa_t& operator=(const fxaa_t&) = delete;
+
+    // contrast_threshold: 局部对比度低于它的像素直接跳过（亮度范围[0, 1]）
+    // relative_threshold: 对比度低于局部最大亮度乘以它时也跳过
+    // subpixel_blending: 子像素混合的强度，0表示只处理边缘
+    void set_quality(float contrast_threshold, float relative_threshold, float subpixel_blending);
+
+    void apply(framebuffer_t* framebuffer);
+
+   private:
+    struct change_t {
+        int index;
+        uint color;
+    };
+
+    void compute_luma(int row_begin, int row_end);
+    void filter_rows(int row_begin, int row_end);
+    void defer_changes(const std::vector<change_t>& changes);
+
+    float contrast_threshold, relative_threshold, subpixel_blending;
+
+    // 处理当前帧时使用
+    int width, height;
+    uint* target;
+    std::vector<uchar> luma;
+    // 每块的第一行和最后一行会被相邻的块读取，等所有块处理完再写回
+    std::mutex deferred_lock;
+    std::vector<change_t> deferred;
+};
+
+#endif  // RASTERIZER_POSTPROCESS_H_
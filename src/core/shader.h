@@ -1,8 +1,27 @@
 #ifndef RASTERIZER_SHADER_H_
 #define RASTERIZER_SHADER_H_
 
+#include <cstddef>
+
 #include "maths.h"
 
+// 第i位表示fragment shader会读取varying中的第i个float，超过64个float的部分总是插值
+typedef unsigned long long varying_mask_t;
+const varying_mask_t ALL_VARYINGS = ~0ull;
+const varying_mask_t NO_VARYINGS = 0ull;
+
+// 由成员的字节偏移和大小得到mask，例如varying_mask(offsetof(blin_varying_t, texcoords), sizeof(vec2))
+inline varying_mask_t varying_mask(size_t offset, size_t size) {
+    varying_mask_t mask = 0;
+    for(size_t i = offset / sizeof(float); i < (offset + size) / sizeof(float) && i < 64; i++) {
+        mask |= 1ull << i;
+    }
+    return mask;
+}
+
+// fragment shader最多的输出个数（MRT）。第0个输出为fragment_shader的返回值，其余的用write_output写入
+const int max_num_of_outputs = 4;
+
 class shader_t {
    public:
     shader_t(int sizeof_varyings);
@@ -10,18 +29,78 @@ class shader_t {
 
     virtual const vec4 vertex_shader(const void *attribs, void *varyings) = 0;
     virtual const vec4 fragment_shader(const void *varyings, bool &discard) = 0;
+    // 实例化绘制时代替vertex_shader，instance_attribs为当前实例的属性。
+    // 可能在多个线程中同时调用，只能读取uniform。
+    // 用虚函数版本的draw_primitives_instanced绘制时必须重写，默认的实现会触发assert
+    virtual const vec4 instance_vertex_shader(const void *attribs, const void *instance_attribs, void *varyings);
+
+    // 每次绘制开始前调用一次，用来预先计算只依赖uniform的量（例如MVP矩阵）
+    virtual void prepare();
 
     int get_sizeof_varyings() const;
 
+    // 光栅化阶段只对mask中的varying做插值，其余的值未定义。在prepare()之后读取，可以按pass切换
+    varying_mask_t get_used_varyings() const;
+
     void bind_uniform(void *uniform_data);
 
+    // 由光栅化阶段在调用fragment_shader前设置，指向当前2x2 quad中varying的屏幕空间导数
+    void bind_derivatives(const void *dfdx, const void *dfdy);
+
+    // fragment会写出的输出个数（包括返回值），在prepare()之后读取。
+    // 只有framebuffer中存在的颜色附件会被写入
+    int get_num_outputs() const;
+    // 当前fragment的第index个输出，index >= 1
+    const vec4 &get_output(int index) const;
+
+    // fragment是否可能discard、是否用write_depth修改深度，在prepare()之后读取。
+    // 两者都为false时光栅化阶段在fragment之前完成深度测试并写入深度（early Z），否则在之后（late Z）
+    bool may_discard() const;
+    bool writes_depth() const;
+    // 当前fragment写入的深度
+    float get_depth_output() const;
+
     shader_t(const shader_t &) = delete;
     shader_t &operator=(const shader_t &) = delete;
 
    protected:
+    // 与varying布局相同，不在光栅化阶段调用时为NULL
+    const void *get_dfdx() const;
+    const void *get_dfdy() const;
+
+    // 默认读取全部varying；只需要深度的shader（shadow map、depth prepass）设为NO_VARYINGS
+    void set_used_varyings(varying_mask_t mask);
+
+    // 默认只有一个输出。声明了多个输出时，每个fragment都要写入所有的输出
+    void set_num_outputs(int num);
+    void write_output(int index, const vec4 &value);
+
+    // 默认可能discard（总是正确，但只能late Z），不会discard的shader设为false以使用early Z
+    void set_may_discard(bool value);
+    // 声明修改深度后，每个fragment都要用write_depth写入[0, 1]的深度，它代替插值的深度参与深度测试
+    void set_writes_depth(bool value);
+    void write_depth(float depth);
+
     void *uniforms;
 
    private:
     int sizeof_varyings;
+    varying_mask_t used_varyings;
+    const void *dfdx_varyings;
+    const void *dfdy_varyings;
+    int num_outputs;
+    vec4 outputs[max_num_of_outputs];
+    bool discard_flag;
+    bool depth_flag;
+    float depth_output;
 };
+
+// 每个fragment都会调用，放在头文件中内联
+inline const vec4 &shader_t::get_output(int index) const { return outputs[index]; }
+
+inline void shader_t::write_output(int index, const vec4 &value) { outputs[index] = value; }
+
+inline float shader_t::get_depth_output() const { return depth_output; }
+
+inline void shader_t::write_depth(float depth) { depth_output = depth; }
 #endif  // RASTERIZER_SHADER_H_
@@ -5,6 +5,7 @@
 
 #include "graphics.h"
 #include "image.h"
+#include "mapped_file.h"
 #include "maths.h"
 
 typedef enum { USAGE_SRGB_COLOR, USAGE_RAW_DATA, USAGE_LINEAR_COLOR } usage_t;
@@ -20,6 +21,10 @@ typedef enum {
     SAMPLE_SURROUND_MODE_BORDER
 } sample_surround_mode_t;
 
+// 从文件加载时会生成mipmap，并把转换后的texel和mipmap写入缓存<filename>.<usage>.tbin，
+// 之后的加载直接映射缓存文件并从中采样，跳过解码、翻转、颜色空间转换和生成mipmap。
+// 缓存是无损的：可以时第0层保存为RGBA8，其余为vec4，采样结果与不使用缓存时相同。
+// load_from_*写入第0层之后只保留第0层，不再使用mipmap
 class texture_t {
    public:
     texture_t(int w, int h);
@@ -36,8 +41,31 @@ class texture_t {
     void load_from_image(image_t* image, usage_t usage);
 
     vec4 sample(vec2 uv);
+    // 指定mipmap层级，非整数时在相邻两层间插值
+    vec4 sample(vec2 uv, float lod);
+    // 根据uv的屏幕空间导数选择mipmap层级
+    vec4 sample(vec2 uv, vec2 duvdx, vec2 duvdy);
+
+    int get_num_levels() const;
 
    private:
+    static const int max_levels = 16;
+
+    struct level_t {
+        int width, height;
+        // 为true时每个texel为4字节的RGBA8（只出现在映射的缓存中），否则为vec4
+        bool rgba8;
+        const void* texels;
+    };
+
+    vec4 sample_level(const level_t& level, float u, float v) const;
+    bool wrap_uv(float& u, float& v) const;
+
+    bool load_from_cache(const std::string& filename, usage_t usage);
+    void write_cache(const std::string& filename, usage_t usage, uint level0_format) const;
+    void generate_mipmaps();
+    void prepare_write();
+
     void ldr_image_to_texture(image_t* image);
     void hdr_image_to_texture(image_t* image);
     void srgb_to_linear();
@@ -46,7 +74,41 @@ class texture_t {
     sample_surround_mode_t surround_mode = SAMPLE_SURROUND_MODE_REPEAT;
     vec4 border_color;
     int width, height;
+    // 自己的内存，所有层级连续存放，buffer指向第0层；从缓存加载时为NULL
     vec4* buffer;
+    int num_levels;
+    level_t levels[max_levels];
+    // 非空时levels指向映射的缓存文件（只读）
+    mapped_file_t* cache;
+};
+
+// 直接读取framebuffer深度缓冲的只读视图，不拷贝，framebuffer的内容变化后立即可见。
+// uv的(0, 0)为左下角，texel中心与光栅化的像素中心对齐；uv在[0, 1]外视为最远处。
+// depth为渲染这个深度缓冲时使用的深度状态，决定NDC的z到深度的换算以及哪一边更远（reverse Z时远处为0）
+class depth_texture_t {
+   public:
+    depth_texture_t(const framebuffer_t* framebuffer, const depth_state_t& depth = depth_state_t());
+
+    int get_width() const;
+    int get_height() const;
+
+    // 把NDC的z换算成与存储的深度比较的值，并向近处偏移bias
+    float reference_depth(float ndc_z, float bias) const;
+
+    float sample(vec2 uv) const;
+    // 深度比较，ref不比存储的深度更远时返回1（被照亮），否则返回0
+    float sample_compare(vec2 uv, float ref) const;
+    // percentage-closer filtering：在(2 * radius + 1)^2个texel上做深度比较后取平均
+    float sample_pcf(vec2 uv, float ref, int radius) const;
+
+   private:
+    float fetch(int x, int y) const;
+    bool is_lit(float ref, float depth) const;
+
+    const framebuffer_t* framebuffer;
+    bool zero_to_one;
+    // 深度比较为GREATER/GEQUAL时越大越近
+    bool reversed;
 };
 
 // class cube_texture_t {
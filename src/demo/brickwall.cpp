@@ -29,12 +29,12 @@ int main(int argc, char *argv[]) {
     register_input(window);
 
     /* mesh setup */
-    mesh_t wall("assets/model/brickwall/brickwall.obj");
+    asset_t<mesh_t> wall("assets/model/brickwall/brickwall.obj");
 
     /* texture setup */
-    texture_t t_diffuse("assets/model/brickwall/brickwall_diffuse.jpg", USAGE_SRGB_COLOR);
-    texture_t t_normal("assets/model/brickwall/brickwall_normal.jpg", USAGE_RAW_DATA);
-    t_normal.set_interp_mode(SAMPLE_INTERP_MODE_NEAREST);
+    asset_t<texture_t> t_diffuse("assets/model/brickwall/brickwall_diffuse.jpg", USAGE_SRGB_COLOR);
+    asset_t<texture_t> t_normal("assets/model/brickwall/brickwall_normal.jpg", USAGE_RAW_DATA);
+    texture_t t_placeholder(1, 1);
 
     /* camera setup */
     pinned_camera_t camera(1.0 * window_width / window_height, PROJECTION_MODE_PERSPECTIVE);
@@ -53,8 +53,8 @@ int main(int argc, char *argv[]) {
     /* uniform */
     memset(&blin_uniforms, 0, sizeof(blin_uniform_t));
     blin_uniforms.camera_pos = camera.get_position();
-    blin_uniforms.diffuse_texture = &t_diffuse;
-    blin_uniforms.normal_texture = &t_normal;
+    blin_uniforms.diffuse_texture = &t_placeholder;
+    blin_uniforms.normal_texture = NULL;
     blin_uniforms.num_of_point_lights = 1;
     blin_uniforms.point_lights = point_lights;
     blin_uniforms.model_matrix = euler_YXZ_rotate(wall_rotation);
@@ -65,8 +65,8 @@ int main(int argc, char *argv[]) {
     /* render */
     framebuffer_t framebuffer(window_width, window_height);
     while(!window_should_close(window)) {
-        framebuffer.clear_color(background);
-        framebuffer.clear_depth(1.0f);
+        framebuffer.fast_clear_color_buffer(background);
+        framebuffer.fast_clear_depth_buffer(1.0f);
 
         camera.update_transform(window);
 
@@ -75,7 +75,16 @@ int main(int argc, char *argv[]) {
         blin_uniforms.view_matrix = camera.get_view_matrix();
         blin_uniforms.model_matrix = euler_YXZ_rotate(wall_rotation);
         point_lights[0].position = light_pos;
-        draw_primitives(&framebuffer, wall.get_vbo(), &blin_shader);
+
+        // 资源加载完成前使用占位纹理
+        blin_uniforms.diffuse_texture = t_diffuse.get(&t_placeholder);
+        if(t_normal.is_ready()) {
+            blin_uniforms.normal_texture = t_normal.get(NULL);
+            blin_uniforms.normal_texture->set_interp_mode(SAMPLE_INTERP_MODE_NEAREST);
+        }
+        if(wall.is_ready()) {
+            draw_primitives<blin_shader_t>(&framebuffer, wall.get(NULL)->get_vbo(), &blin_shader);
+        }
         gui(window);
         window_draw_buffer(window, &framebuffer);
         input_poll_events();
@@ -0,0 +1,148 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "core/api.h"
+#include "shaders/gbuffer_shader.h"
+#include "utils/EventManager.h"
+
+using namespace std;
+
+const int w = 800, h = 600;
+static const vec3 CAMERA_POSITION(0, 3, 8);
+static const vec3 CAMERA_TARGET(0, 0, 0);
+
+void gui(window_t* window);
+void register_input(window_t* window);
+
+/* gui setup */
+vec4 background;
+int view_mode = 0;
+const char* view_modes[] = {"Color", "Normal", "Object ID"};
+const char* object_names[] = {"None", "Cow", "Ground"};
+int hovered_object = 0;
+
+// 把第index个颜色附件复制到display中显示，物体编号映射为不同的颜色
+void show_attachment(framebuffer_t* gbuffer, int index, framebuffer_t* display) {
+    static const vec4 id_colors[] = {vec4(0.0f, 0.0f, 0.0f, 1.0f), vec4(0.9f, 0.4f, 0.2f, 1.0f), vec4(0.2f, 0.5f, 0.9f, 1.0f)};
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            vec4 value = gbuffer->get_attachment_color(index, x, y);
+            if(index == 2) value = id_colors[(int)value.x() % 3];
+            display->set_color(x, y, value);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    /* platform setup */
+    platform_initialize();
+
+    /* window & input setup */
+    window_t *window = window_create("g-buffer", w, h);
+    register_input(window);
+
+    /* mesh setup */
+    asset_t<mesh_t> cow("assets/model/cow/cow.obj");
+    asset_t<mesh_t> ground("assets/model/brickwall/brickwall.obj");
+    mat4 ground_model = translate(vec3(0.0f, -1.85f, 0.0f)) * euler_YXZ_rotate(vec3(-90.0f, 0.0f, 0.0f)) * scale(vec3(5.0f));
+
+    /* texture setup */
+    asset_t<texture_t> t_cow("assets/model/cow/cow_diffuse.png", USAGE_SRGB_COLOR);
+    asset_t<texture_t> t_ground("assets/model/brickwall/brickwall_diffuse.jpg", USAGE_SRGB_COLOR);
+    texture_t t_placeholder(1, 1);
+
+    /* camera setup */
+    pinned_camera_t camera(1.0f * w / h, PROJECTION_MODE_PERSPECTIVE);
+    camera.set_zoom(90.0f);
+    camera.set_transform(CAMERA_POSITION, CAMERA_TARGET);
+
+    /* lights */
+    blin_point_light_t point_lights[1];
+    point_lights[0].color = vec3(3.0f);
+    point_lights[0].position = vec3(-3.0f, 5.0f, 3.0f);
+
+    /* shader setup */
+    gbuffer_uniform_t uniforms;
+    gbuffer_shader_t shader;
+    shader.bind_uniform(&uniforms);
+
+    /* uniform */
+    memset(&uniforms, 0, sizeof(gbuffer_uniform_t));
+    uniforms.normal_texture = NULL;
+    uniforms.num_of_point_lights = 1;
+    uniforms.point_lights = point_lights;
+
+    /* g-buffer：颜色、法线和物体编号在一次绘制中写出 */
+    framebuffer_t gbuffer(w, h);
+    int normal_attachment = gbuffer.add_color_attachment(COLOR_FORMAT_RGBA8);
+    int id_attachment = gbuffer.add_color_attachment(COLOR_FORMAT_RGBA32F);
+    framebuffer_t display(w, h);
+
+    /* render */
+    while(!window_should_close(window)) {
+        camera.update_transform(window);
+
+        gbuffer.fast_clear_color_buffer(background);
+        gbuffer.fast_clear_depth_buffer(1.0f);
+        gbuffer.clear_attachment(normal_attachment, vec4(0.0f));
+        gbuffer.clear_attachment(id_attachment, vec4(0.0f));
+        uniforms.camera_pos = camera.get_position();
+        uniforms.proj_matrix = camera.get_projection_matrix();
+        uniforms.view_matrix = camera.get_view_matrix();
+        if(cow.is_ready()) {
+            uniforms.model_matrix = scale(vec3(2.5f));
+            uniforms.diffuse_texture = t_cow.get(&t_placeholder);
+            uniforms.object_id = 1;
+            draw_primitives<gbuffer_shader_t>(&gbuffer, cow.get(NULL)->get_vbo(), &shader);
+        }
+        if(ground.is_ready()) {
+            uniforms.model_matrix = ground_model;
+            uniforms.diffuse_texture = t_ground.get(&t_placeholder);
+            uniforms.object_id = 2;
+            draw_primitives<gbuffer_shader_t>(&gbuffer, ground.get(NULL)->get_vbo(), &shader);
+        }
+
+        // 拾取：直接读取光标下的物体编号，不需要再渲染一遍
+        float cursor_x, cursor_y;
+        hovered_object = 0;
+        if(input_query_cursor(window, &cursor_x, &cursor_y)) {
+            int x = (int)cursor_x, y = h - 1 - (int)cursor_y;
+            if(x >= 0 && x < w && y >= 0 && y < h) {
+                hovered_object = (int)gbuffer.get_attachment_color(id_attachment, x, y).x();
+            }
+        }
+
+        gui(window);
+        if(view_mode == 0) {
+            window_draw_buffer(window, &gbuffer);
+        } else {
+            show_attachment(&gbuffer, view_mode == 1 ? normal_attachment : id_attachment, &display);
+            window_draw_buffer(window, &display);
+        }
+        input_poll_events();
+    }
+
+    platform_terminate();
+    return 0;
+}
+
+
+void gui(window_t* window) {
+    if(!window) return;
+    ImGuiContext* ctx = (ImGuiContext*)window_get_gui_context(window);
+    if(!ctx) return;
+    ImGui::SetCurrentContext(ctx);
+    ImGui::Begin("Info");
+    ImGui::Combo("View", &view_mode, view_modes, 3);
+    ImGui::Text("Hovered object: %s", object_names[hovered_object % 3]);
+    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::End();
+}
+
+void register_input(window_t* window) {
+    pinned_camera_t::register_input();
+    EventManager::registerEvent(SDLK_ESCAPE | Events::KEYBOARD_PRESS, [](window_t* window){
+        window_close(window);
+    });
+}
@@ -0,0 +1,146 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "core/api.h"
+#include "shaders/blin_shader.h"
+#include "utils/EventManager.h"
+
+using namespace std;
+
+const int w = 800, h = 600;
+const int grid_size = 10;
+const int num_of_cubes = grid_size * grid_size * grid_size;
+static const vec3 CAMERA_POSITION(0, 0, 40);
+static const vec3 CAMERA_TARGET(0, 0, 0);
+
+void gui(window_t* window);
+void register_input(window_t* window);
+
+/* gui setup */
+vec4 background;
+int draw_mode = 0;
+const char* draw_modes[] = {"Instanced", "Per-object draws", "Command list"};
+bool spin = true;
+
+int main(int argc, char *argv[]) {
+    /* platform setup */
+    platform_initialize();
+
+    /* window & input setup */
+    window_t *window = window_create("instancing", w, h);
+    register_input(window);
+
+    /* mesh setup */
+    asset_t<mesh_t> cube("assets/model/cube/cube.obj");
+    // 10x10x10的网格
+    vector<vec3> cube_positions;
+    for(int z = 0; z < grid_size; z++) {
+        for(int y = 0; y < grid_size; y++) {
+            for(int x = 0; x < grid_size; x++) {
+                cube_positions.push_back((vec3(x, y, z) - vec3((grid_size - 1) * 0.5f)) * 3.0f);
+            }
+        }
+    }
+
+    /* texture setup */
+    asset_t<texture_t> t_cube("assets/model/cube/cube_0.png", USAGE_SRGB_COLOR);
+    texture_t t_placeholder(1, 1);
+
+    /* camera setup */
+    pinned_camera_t camera(1.0f * w / h, PROJECTION_MODE_PERSPECTIVE);
+    camera.set_zoom(90.0f);
+    camera.set_transform(CAMERA_POSITION, CAMERA_TARGET);
+
+    /* lights */
+    blin_point_light_t point_lights[1];
+    point_lights[0].color = vec3(30.0f);
+    point_lights[0].position = vec3(0.0f, 20.0f, 20.0f);
+
+    /* shader setup */
+    blin_uniform_t uniforms;
+    blin_shader_t shader;
+    shader.bind_uniform(&uniforms);
+
+    /* uniform */
+    memset(&uniforms, 0, sizeof(blin_uniform_t));
+    uniforms.normal_texture = NULL;
+    uniforms.num_of_point_lights = 1;
+    uniforms.point_lights = point_lights;
+
+    /* render */
+    framebuffer_t framebuffer(w, h);
+    vbo_t instances(sizeof(blin_instance_t), num_of_cubes);
+    vector<int> order(num_of_cubes);
+    command_list_t commands;
+    float angle = 0.0f;
+    while(!window_should_close(window)) {
+        camera.update_transform(window);
+
+        framebuffer.fast_clear_color_buffer(background);
+        framebuffer.fast_clear_depth_buffer(1.0f);
+        uniforms.camera_pos = camera.get_position();
+        uniforms.proj_matrix = camera.get_projection_matrix();
+        uniforms.view_matrix = camera.get_view_matrix();
+        uniforms.diffuse_texture = t_cube.get(&t_placeholder);
+        if(spin) angle += 1.0f;
+
+        // 从近到远绘制，被遮挡的fragment在early Z阶段就被剔除
+        sort_back_to_front(uniforms.view_matrix, cube_positions.data(), num_of_cubes, order.data());
+        for(int i = 0; i < num_of_cubes; i++) {
+            int index = order[num_of_cubes - 1 - i];
+            mat4 model = translate(cube_positions[index]) * euler_YXZ_rotate(vec3(angle + index * 7.0f, angle * 0.5f, 0.0f));
+            *(blin_instance_t*)instances.at(i) = make_blin_instance(model);
+        }
+
+        if(cube.is_ready()) {
+            const vbo_t* vbo = cube.get(NULL)->get_vbo();
+            if(draw_mode == 0) {
+                draw_primitives_instanced<blin_shader_t>(&framebuffer, vbo, NULL, &instances, &shader);
+            } else if(draw_mode == 1) {
+                // 对照：逐个物体设置model_matrix绘制
+                for(int i = 0; i < num_of_cubes; i++) {
+                    uniforms.model_matrix = ((const blin_instance_t*)instances.at(i))->model_matrix;
+                    draw_primitives<blin_shader_t>(&framebuffer, vbo, &shader);
+                }
+            } else {
+                // 记录时复制uniform，之后修改model_matrix不影响已经记录的绘制。
+                // shader和mesh都相同，排序保持从近到远的顺序
+                for(int i = 0; i < num_of_cubes; i++) {
+                    uniforms.model_matrix = ((const blin_instance_t*)instances.at(i))->model_matrix;
+                    commands.draw<blin_shader_t>(vbo, NULL, &shader, &uniforms, sizeof(blin_uniform_t));
+                }
+                commands.submit(&framebuffer);
+            }
+        }
+
+        gui(window);
+        window_draw_buffer(window, &framebuffer);
+        input_poll_events();
+    }
+
+    platform_terminate();
+    return 0;
+}
+
+
+void gui(window_t* window) {
+    if(!window) return;
+    ImGuiContext* ctx = (ImGuiContext*)window_get_gui_context(window);
+    if(!ctx) return;
+    ImGui::SetCurrentContext(ctx);
+    ImGui::Begin("Info");
+    ImGui::Text("Cubes: %d", num_of_cubes);
+    ImGui::Combo("Draw", &draw_mode, draw_modes, 3);
+    ImGui::Checkbox("Spin", &spin);
+    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::End();
+}
+
+void register_input(window_t* window) {
+    pinned_camera_t::register_input();
+    EventManager::registerEvent(SDLK_ESCAPE | Events::KEYBOARD_PRESS, [](window_t* window){
+        window_close(window);
+    });
+}
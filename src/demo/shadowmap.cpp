@@ -0,0 +1,150 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "core/api.h"
+#include "shaders/blin_shader.h"
+#include "shaders/depth_shader.h"
+#include "utils/EventManager.h"
+
+using namespace std;
+
+const int w = 800, h = 600;
+const int shadow_map_size = 1024;
+static const vec3 CAMERA_POSITION(0, 3, 8);
+static const vec3 CAMERA_TARGET(0, 0, 0);
+
+void gui(window_t* window);
+void register_input(window_t* window);
+
+/* gui setup */
+vec4 background;
+vec3 cow_rotation(0.0f, -70.0f, 0.0f);
+vec3 light_pos(-3.0f, 5.0f, 3.0f);
+float depth_bias = 0.0005f;
+int pcf_radius = 1;
+bool show_shadow = true;
+
+int main(int argc, char *argv[]) {
+    /* platform setup */
+    platform_initialize();
+
+    /* window & input setup */
+    window_t *window = window_create("shadow map", w, h);
+    register_input(window);
+
+    /* mesh setup */
+    asset_t<mesh_t> cow("assets/model/cow/cow.obj");
+    asset_t<mesh_t> ground("assets/model/brickwall/brickwall.obj");
+    // 把xy平面上的墙放倒作为地面，正面朝向+y
+    mat4 ground_model = translate(vec3(0.0f, -1.85f, 0.0f)) * euler_YXZ_rotate(vec3(-90.0f, 0.0f, 0.0f)) * scale(vec3(5.0f));
+
+    /* texture setup */
+    asset_t<texture_t> t_cow("assets/model/cow/cow_diffuse.png", USAGE_SRGB_COLOR);
+    asset_t<texture_t> t_ground("assets/model/brickwall/brickwall_diffuse.jpg", USAGE_SRGB_COLOR);
+    texture_t t_placeholder(1, 1);
+
+    /* camera setup */
+    pinned_camera_t camera(1.0f * w / h, PROJECTION_MODE_PERSPECTIVE);
+    camera.set_zoom(90.0f);
+    camera.set_transform(CAMERA_POSITION, CAMERA_TARGET);
+
+    /* lights */
+    blin_point_light_t point_lights[1];
+    point_lights[0].color = vec3(3.0f);
+    point_lights[0].position = light_pos;
+
+    /* shadow map：从光源视角只渲染深度，depth_texture_t直接读取它的深度缓冲 */
+    framebuffer_t shadow_framebuffer(shadow_map_size, shadow_map_size);
+    depth_texture_t shadow_map(&shadow_framebuffer);
+
+    depth_uniform_t depth_uniforms;
+    depth_shader_t depth_shader;
+    depth_shader.bind_uniform(&depth_uniforms);
+
+    /* shader setup */
+    blin_shadow_uniform_t blin_uniforms;
+    blin_shadow_shader_t blin_shader;
+    blin_shader.bind_uniform(&blin_uniforms);
+
+    /* uniform */
+    memset(&blin_uniforms, 0, sizeof(blin_shadow_uniform_t));
+    blin_uniforms.normal_texture = NULL;
+    blin_uniforms.num_of_point_lights = 1;
+    blin_uniforms.point_lights = point_lights;
+    blin_uniforms.shadow_light = 0;
+
+    /* render */
+    framebuffer_t framebuffer(w, h);
+    while(!window_should_close(window)) {
+        camera.update_transform(window);
+        mat4 cow_model = euler_YXZ_rotate(cow_rotation) * scale(vec3(2.5f));
+        point_lights[0].position = light_pos;
+
+        // light pass
+        mat4 light_view = lookat(light_pos, CAMERA_TARGET, vec3(0.0f, 1.0f, 0.0f));
+        mat4 light_proj = perspective(1.0f, 20.0f, 90.0f, 1.0f);
+        shadow_framebuffer.fast_clear_depth_buffer(1.0f);
+        depth_uniforms.view_matrix = light_view;
+        depth_uniforms.proj_matrix = light_proj;
+        if(cow.is_ready()) {
+            depth_uniforms.model_matrix = cow_model;
+            draw_depth(&shadow_framebuffer, cow.get(NULL)->get_vbo(), &depth_shader);
+        }
+        if(ground.is_ready()) {
+            depth_uniforms.model_matrix = ground_model;
+            draw_depth(&shadow_framebuffer, ground.get(NULL)->get_vbo(), &depth_shader);
+        }
+
+        // camera pass
+        framebuffer.fast_clear_color_buffer(background);
+        framebuffer.fast_clear_depth_buffer(1.0f);
+        blin_uniforms.camera_pos = camera.get_position();
+        blin_uniforms.proj_matrix = camera.get_projection_matrix();
+        blin_uniforms.view_matrix = camera.get_view_matrix();
+        blin_uniforms.shadow_map = show_shadow ? &shadow_map : NULL;
+        blin_uniforms.light_matrix = light_proj * light_view;
+        blin_uniforms.depth_bias = depth_bias;
+        blin_uniforms.pcf_radius = pcf_radius;
+        if(cow.is_ready()) {
+            blin_uniforms.model_matrix = cow_model;
+            blin_uniforms.diffuse_texture = t_cow.get(&t_placeholder);
+            draw_primitives<blin_shadow_shader_t>(&framebuffer, cow.get(NULL)->get_vbo(), &blin_shader);
+        }
+        if(ground.is_ready()) {
+            blin_uniforms.model_matrix = ground_model;
+            blin_uniforms.diffuse_texture = t_ground.get(&t_placeholder);
+            draw_primitives<blin_shadow_shader_t>(&framebuffer, ground.get(NULL)->get_vbo(), &blin_shader);
+        }
+
+        gui(window);
+        window_draw_buffer(window, &framebuffer);
+        input_poll_events();
+    }
+
+    platform_terminate();
+    return 0;
+}
+
+
+void gui(window_t* window) {
+    if(!window) return;
+    ImGuiContext* ctx = (ImGuiContext*)window_get_gui_context(window);
+    if(!ctx) return;
+    ImGui::SetCurrentContext(ctx);
+    ImGui::Begin("Info");
+    ImGui::Checkbox("Shadow", &show_shadow);
+    ImGui::SliderFloat3("Light positon", light_pos.data(), -8, 8);
+    ImGui::SliderFloat3("Cow rotation", cow_rotation.data(), -180, 180);
+    ImGui::SliderFloat("Depth bias", &depth_bias, 0.0f, 0.01f, "%.5f");
+    ImGui::SliderInt("PCF radius", &pcf_radius, 0, 3);
+    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::End();
+}
+
+void register_input(window_t* window) {
+    pinned_camera_t::register_input();
+    EventManager::registerEvent(SDLK_ESCAPE | Events::KEYBOARD_PRESS, [](window_t* window){
+        window_close(window);
+    });
+}
@@ -4,6 +4,7 @@
 
 #include "core/api.h"
 #include "shaders/blin_shader.h"
+#include "shaders/line_shader.h"
 #include "utils/EventManager.h"
 
 using namespace std;
@@ -12,10 +13,50 @@ const int w = 800, h = 600;
 static const vec3 CAMERA_POSITION(0, 0, 15);
 static const vec3 CAMERA_TARGET(0, 0, 0);
 bool wire_frame;
+bool record;
+bool virtual_shader;
+int msaa_level;  // 0: 1x, 1: 2x, 2: 4x
+bool use_fxaa;
+bool reverse_z;
+bool show_normals;
+bool show_bbox;
 
 void gui(window_t* window);
 void register_input(window_t* window);
 
+// 调试用的直线：每个顶点的法线（长度length）和包围盒的12条边
+vbo_t* create_normal_lines(const mesh_t* mesh, float length) {
+    const vbo_t* vertices = mesh->get_vbo();
+    vbo_t* lines = new vbo_t(sizeof(line_attribs_t), vertices->get_count() * 2);
+    for(int i = 0; i < vertices->get_count(); i++) {
+        const vertex_t* vertex = (const vertex_t*)vertices->at(i);
+        line_attribs_t* line = (line_attribs_t*)lines->at(i * 2);
+        line[0].position = vertex->position;
+        line[1].position = vertex->position + vertex->normal * length;
+        line[0].color = line[1].color = vec3(0.2f, 0.4f, 1.0f);
+    }
+    return lines;
+}
+
+vbo_t* create_bbox_lines(const mesh_t* mesh) {
+    vec3 lo = mesh->get_bbox_min(), hi = mesh->get_bbox_max();
+    vbo_t* lines = new vbo_t(sizeof(line_attribs_t), 24);
+    int n = 0;
+    // 每条边连接只有一个坐标不同的两个角
+    for(int corner = 0; corner < 8; corner++) {
+        for(int axis = 0; axis < 3; axis++) {
+            if(corner >> axis & 1) continue;
+            int other = corner | (1 << axis);
+            line_attribs_t* line = (line_attribs_t*)lines->at(n);
+            line[0].position = vec3(corner & 1 ? hi.x() : lo.x(), corner & 2 ? hi.y() : lo.y(), corner & 4 ? hi.z() : lo.z());
+            line[1].position = vec3(other & 1 ? hi.x() : lo.x(), other & 2 ? hi.y() : lo.y(), other & 4 ? hi.z() : lo.z());
+            line[0].color = line[1].color = vec3(1.0f, 0.8f, 0.1f);
+            n += 2;
+        }
+    }
+    return lines;
+}
+
 int main(int argc, char *argv[]) {
     /* platform setup */
     platform_initialize();
@@ -25,11 +66,12 @@ int main(int argc, char *argv[]) {
     register_input(window);
 
     /* mesh setup */
-    mesh_t cow("assets/model/cow/cow.obj");
+    asset_t<mesh_t> cow("assets/model/cow/cow.obj");
     mat4 cow_model;
 
     /* texture setup */
-    texture_t t_diffuse("assets/model/cow/cow_diffuse.png", USAGE_SRGB_COLOR);
+    asset_t<texture_t> t_diffuse("assets/model/cow/cow_diffuse.png", USAGE_SRGB_COLOR);
+    texture_t t_placeholder(1, 1);
 
     /* camera setup */
     pinned_camera_t camera(800.0f / 600.0f, PROJECTION_MODE_PERSPECTIVE);
@@ -53,7 +95,7 @@ int main(int argc, char *argv[]) {
     /* uniform */
     memset(&blin_uniforms, 0, sizeof(blin_uniform_t));
     blin_uniforms.camera_pos = camera.get_position();
-    blin_uniforms.diffuse_texture = &t_diffuse;
+    blin_uniforms.diffuse_texture = &t_placeholder;
     blin_uniforms.normal_texture = NULL;
     blin_uniforms.num_of_point_lights = 2;
     blin_uniforms.point_lights = point_lights;
@@ -62,15 +104,41 @@ int main(int argc, char *argv[]) {
     blin_uniforms.proj_matrix = camera.get_projection_matrix();
     blin_uniforms.view_matrix = camera.get_view_matrix();
 
+    line_uniform_t line_uniforms;
+    line_shader_t line_shader;
+    line_shader.bind_uniform(&line_uniforms);
+    vbo_t* normal_lines = NULL;
+    vbo_t* bbox_lines = NULL;
+
     /* gui setup */
     vec4 background;
     vec3 cow_rotation;
 
     /* render */
-    framebuffer_t framebuffer(w, h);
+    // 录制时两个framebuffer交替使用，后台写文件的同时渲染下一帧
+    framebuffer_t* framebuffers[2] = {new framebuffer_t(w, h), new framebuffer_t(w, h)};
+    frame_writer_t writer;
+    fxaa_t fxaa;
+    int frame_count = 0;
     while(!window_should_close(window)) {
-        framebuffer.clear_color(background);
-        framebuffer.clear_depth(1.0f);
+        // 切换MSAA时重新创建framebuffer，需要先等后台写完
+        int num_samples = 1 << msaa_level;
+        if(framebuffers[0]->get_num_samples() != num_samples) {
+            writer.wait();
+            for(int i = 0; i < 2; i++) {
+                delete framebuffers[i];
+                framebuffers[i] = new framebuffer_t(w, h, num_samples);
+            }
+        }
+        framebuffer_t& framebuffer = *framebuffers[frame_count & 1];
+        // 录制时write()已经等过这一帧，停止录制后最后一帧可能还在写
+        if(writer.is_reading(&framebuffer)) writer.wait();
+        // reverse Z时近处的深度为1，远处为0
+        camera.set_reverse_z(reverse_z);
+        render_state_t state;
+        if(reverse_z) state.depth = reverse_z_depth_state();
+        framebuffer.fast_clear_color_buffer(background);
+        framebuffer.fast_clear_depth_buffer(reverse_z ? 0.0f : 1.0f);
 
         camera.update_transform(window);
         cow_model = euler_YXZ_rotate(cow_rotation) * scale(vec3(5.0f));
@@ -82,17 +150,42 @@ int main(int argc, char *argv[]) {
         
         // camera position
         blin_uniforms.camera_pos = camera.get_position();
+
+        // 资源加载完成前使用占位纹理
+        blin_uniforms.diffuse_texture = t_diffuse.get(&t_placeholder);
         
         // render
-        if(wire_frame) {
-            draw_primitives(&framebuffer, cow.get_vbo(), &blin_shader, TRIANGLE_WIRE_FRAME);
-        } else {
-            draw_primitives(&framebuffer, cow.get_vbo(), &blin_shader);
+        if(cow.is_ready()) {
+            PRIMITIVE_TYPE type = wire_frame ? TRIANGLE_WIRE_FRAME : TRIANGLE;
+            if(virtual_shader) {
+                draw_primitives(&framebuffer, cow.get(NULL)->get_vbo(), (shader_t*)&blin_shader, type, &state);
+            } else {
+                draw_primitives<blin_shader_t>(&framebuffer, cow.get(NULL)->get_vbo(), &blin_shader, type, &state);
+            }
+
+            if(!normal_lines) normal_lines = create_normal_lines(cow.get(NULL), 0.05f);
+            if(!bbox_lines) bbox_lines = create_bbox_lines(cow.get(NULL));
+            line_uniforms.model_matrix = cow_model;
+            line_uniforms.view_matrix = blin_uniforms.view_matrix;
+            line_uniforms.proj_matrix = blin_uniforms.proj_matrix;
+            if(show_normals) draw_primitives<line_shader_t>(&framebuffer, normal_lines, &line_shader, LINES, &state);
+            if(show_bbox) draw_primitives<line_shader_t>(&framebuffer, bbox_lines, &line_shader, LINES, &state);
+        }
+        framebuffer.resolve();
+        if(use_fxaa) fxaa.apply(&framebuffer);
+        if(record) {
+            writer.write(&framebuffer, "frame_" + to_string(frame_count) + ".png", FRAME_FORMAT_PNG);
         }
+        frame_count++;
         gui(window);
         window_draw_buffer(window, &framebuffer);
         input_poll_events();
     }
+    writer.wait();
+    delete normal_lines;
+    delete bbox_lines;
+    delete framebuffers[0];
+    delete framebuffers[1];
 
     platform_terminate();
     return 0;
@@ -107,6 +200,13 @@ void gui(window_t* window) {
     ImGui::SetCurrentContext(ctx);
     ImGui::Begin("Info");
     ImGui::Checkbox("Wire Frame", &wire_frame);
+    ImGui::Checkbox("Record", &record);
+    ImGui::Checkbox("Virtual Shader", &virtual_shader);
+    ImGui::Combo("MSAA", &msaa_level, "1x\0" "2x\0" "4x\0");
+    ImGui::Checkbox("FXAA", &use_fxaa);
+    ImGui::Checkbox("Reverse Z", &reverse_z);
+    ImGui::Checkbox("Normals", &show_normals);
+    ImGui::Checkbox("Bounding Box", &show_bbox);
     ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
     ImGui::End();
 }
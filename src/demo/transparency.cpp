@@ -0,0 +1,141 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "core/api.h"
+#include "shaders/blin_shader.h"
+#include "utils/EventManager.h"
+
+using namespace std;
+
+const int w = 800, h = 600;
+const int num_of_cows = 3;
+static const vec3 CAMERA_POSITION(0, 3, 9);
+static const vec3 CAMERA_TARGET(0, 0, 0);
+
+void gui(window_t* window);
+void register_input(window_t* window);
+
+/* gui setup */
+vec4 background;
+float opacity = 0.5f;
+bool sort_cows = true;
+int blend_mode = 0;
+const char* blend_modes[] = {"Alpha", "Additive", "Order independent"};
+oit_stats_t oit_stats;
+
+int main(int argc, char *argv[]) {
+    /* platform setup */
+    platform_initialize();
+
+    /* window & input setup */
+    window_t *window = window_create("transparency", w, h);
+    register_input(window);
+
+    /* mesh setup */
+    asset_t<mesh_t> cow("assets/model/cow/cow.obj");
+    asset_t<mesh_t> ground("assets/model/brickwall/brickwall.obj");
+    mat4 ground_model = translate(vec3(0.0f, -1.85f, 0.0f)) * euler_YXZ_rotate(vec3(-90.0f, 0.0f, 0.0f)) * scale(vec3(6.0f));
+    // 三头牛前后错开，视角变化时绘制顺序也会变化
+    vec3 cow_positions[num_of_cows] = {vec3(-2.5f, 0.0f, -2.0f), vec3(0.0f, 0.0f, 0.0f), vec3(2.5f, 0.0f, 2.0f)};
+
+    /* texture setup */
+    asset_t<texture_t> t_cow("assets/model/cow/cow_diffuse.png", USAGE_SRGB_COLOR);
+    asset_t<texture_t> t_ground("assets/model/brickwall/brickwall_diffuse.jpg", USAGE_SRGB_COLOR);
+    texture_t t_placeholder(1, 1);
+
+    /* camera setup */
+    pinned_camera_t camera(1.0f * w / h, PROJECTION_MODE_PERSPECTIVE);
+    camera.set_zoom(90.0f);
+    camera.set_transform(CAMERA_POSITION, CAMERA_TARGET);
+
+    /* lights */
+    blin_point_light_t point_lights[1];
+    point_lights[0].color = vec3(3.0f);
+    point_lights[0].position = vec3(-3.0f, 5.0f, 3.0f);
+
+    /* shader setup：两个shader共用一份uniform */
+    blin_transparent_uniform_t uniforms;
+    blin_shader_t opaque_shader;
+    blin_transparent_shader_t transparent_shader;
+    opaque_shader.bind_uniform(&uniforms);
+    transparent_shader.bind_uniform(&uniforms);
+
+    /* uniform */
+    memset(&uniforms, 0, sizeof(blin_transparent_uniform_t));
+    uniforms.normal_texture = NULL;
+    uniforms.num_of_point_lights = 1;
+    uniforms.point_lights = point_lights;
+
+    /* render */
+    framebuffer_t framebuffer(w, h);
+    // 每个像素平均两层透明的fragment
+    framebuffer.enable_oit(w * h * 2);
+    while(!window_should_close(window)) {
+        camera.update_transform(window);
+
+        framebuffer.fast_clear_color_buffer(background);
+        framebuffer.fast_clear_depth_buffer(1.0f);
+        uniforms.camera_pos = camera.get_position();
+        uniforms.proj_matrix = camera.get_projection_matrix();
+        uniforms.view_matrix = camera.get_view_matrix();
+        uniforms.opacity = opacity;
+
+        // 先画不透明的地面
+        if(ground.is_ready()) {
+            uniforms.model_matrix = ground_model;
+            uniforms.diffuse_texture = t_ground.get(&t_placeholder);
+            draw_primitives<blin_shader_t>(&framebuffer, ground.get(NULL)->get_vbo(), &opaque_shader);
+        }
+
+        // 再从远到近画半透明的牛
+        if(cow.is_ready()) {
+            int order[num_of_cows] = {0, 1, 2};
+            if(sort_cows) sort_back_to_front(uniforms.view_matrix, cow_positions, num_of_cows, order);
+            render_state_t state;
+            state.blend = blend_mode == 1 ? additive_blend_state() : alpha_blend_state();
+            // OIT不需要排序，牛自身相互遮挡的三角形也能正确混合
+            state.oit = blend_mode == 2;
+            uniforms.diffuse_texture = t_cow.get(&t_placeholder);
+            for(int i = 0; i < num_of_cows; i++) {
+                uniforms.model_matrix = translate(cow_positions[order[i]]) * scale(vec3(2.0f));
+                draw_primitives<blin_transparent_shader_t>(&framebuffer, cow.get(NULL)->get_vbo(), &transparent_shader, TRIANGLE, &state);
+            }
+        }
+        framebuffer.resolve_oit();
+        oit_stats = framebuffer.get_oit_stats();
+
+        gui(window);
+        window_draw_buffer(window, &framebuffer);
+        input_poll_events();
+    }
+
+    platform_terminate();
+    return 0;
+}
+
+
+void gui(window_t* window) {
+    if(!window) return;
+    ImGuiContext* ctx = (ImGuiContext*)window_get_gui_context(window);
+    if(!ctx) return;
+    ImGui::SetCurrentContext(ctx);
+    ImGui::Begin("Info");
+    ImGui::Combo("Blend", &blend_mode, blend_modes, 3);
+    ImGui::SliderFloat("Opacity", &opacity, 0.0f, 1.0f);
+    if(blend_mode == 2) {
+        ImGui::Text("Fragments: %d, overflow: %d", oit_stats.num_fragments, oit_stats.num_overflows);
+        ImGui::Text("Max layers: %d", oit_stats.max_list_length);
+    } else {
+        ImGui::Checkbox("Sort back to front", &sort_cows);
+    }
+    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::End();
+}
+
+void register_input(window_t* window) {
+    pinned_camera_t::register_input();
+    EventManager::registerEvent(SDLK_ESCAPE | Events::KEYBOARD_PRESS, [](window_t* window){
+        window_close(window);
+    });
+}
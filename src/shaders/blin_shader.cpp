@@ -3,43 +3,99 @@
 #include <iostream>
 #include <vector>
 
-blin_shader_t::blin_shader_t() : shader_t(sizeof(blin_varying_t)) {}
+#include "core/pipeline.h"
+
+blin_shader_t::blin_shader_t() : shader_t(sizeof(blin_varying_t)) {
+    // 包括派生的shader都不会discard，可以使用early Z
+    set_may_discard(false);
+}
 
 const vec4 blin_shader_t::vertex_shader(const void *attribs, void *varyings) {
-    vertex_t *vertex = (vertex_t *)attribs;
-    blin_varying_t *blin_varyings = (blin_varying_t *)varyings;
+    return vertex(*(const vertex_t *)attribs, *(blin_varying_t *)varyings);
+}
+
+const vec4 blin_shader_t::instance_vertex_shader(const void *attribs, const void *instance_attribs, void *varyings) {
+    return vertex(*(const vertex_t *)attribs, *(const blin_instance_t *)instance_attribs, *(blin_varying_t *)varyings);
+}
+
+const vec4 blin_shader_t::fragment_shader(const void *varyings, bool &discard) {
+    return fragment(*(const blin_varying_t *)varyings, discard);
+}
+
+void blin_shader_t::prepare() {
     blin_uniform_t *blin_uniforms = (blin_uniform_t *)uniforms;
-    
-    mat3 model = clip_mat4(blin_uniforms->model_matrix);
-    mat4 mvp = blin_uniforms->proj_matrix * blin_uniforms->view_matrix * blin_uniforms->model_matrix;
 
-    vec3 T = model.mul_vec3(vertex->tangent).normalized();
-    vec3 N = model.transpose().inverse().mul_vec3(vertex->normal).normalized();
+    blin_uniforms->model_matrix3 = clip_mat4(blin_uniforms->model_matrix);
+    blin_uniforms->normal_matrix = blin_uniforms->model_matrix3.transpose().inverse();
+    blin_uniforms->mvp_matrix = blin_uniforms->proj_matrix * blin_uniforms->view_matrix * blin_uniforms->model_matrix;
+    blin_uniforms->view_proj_matrix = blin_uniforms->proj_matrix * blin_uniforms->view_matrix;
+}
+
+const blin_instance_t make_blin_instance(const mat4 &model_matrix) {
+    blin_instance_t instance;
+    instance.model_matrix = model_matrix;
+    instance.model_matrix3 = clip_mat4(model_matrix);
+    instance.normal_matrix = instance.model_matrix3.transpose().inverse();
+    return instance;
+}
+
+const vec4 blin_shader_t::vertex(const vertex_t &vertex, blin_varying_t &varyings) {
+    const vertex_t *attribs = &vertex;
+    blin_varying_t *blin_varyings = &varyings;
+    const blin_uniform_t *blin_uniforms = (const blin_uniform_t *)uniforms;
 
-    vec4 position(vertex->position, 1.0f);
+    vec3 T = blin_uniforms->model_matrix3.mul_vec3(attribs->tangent).normalized();
+    vec3 N = blin_uniforms->normal_matrix.mul_vec3(attribs->normal).normalized();
+
+    vec4 position(attribs->position, 1.0f);
     vec4 world_pos = blin_uniforms->model_matrix.mul_vec4(position);
 
     blin_varyings->tangent = T;
     blin_varyings->world_pos = vec3(world_pos.x(), world_pos.y(), world_pos.z());
     blin_varyings->world_normal = N;
-    blin_varyings->texcoords = vertex->texcoord;
+    blin_varyings->texcoords = attribs->texcoord;
 
-    return mvp.mul_vec4(position);
+    return blin_uniforms->mvp_matrix.mul_vec4(position);
 }
 
-const vec4 blin_shader_t::fragment_shader(const void *varyings, bool &discard) {
-    blin_varying_t *blin_varyings = (blin_varying_t *)varyings;
+// 与vertex相同，矩阵来自实例的属性
+const vec4 blin_shader_t::vertex(const vertex_t &vertex, const blin_instance_t &instance, blin_varying_t &varyings) {
+    const blin_uniform_t *blin_uniforms = (const blin_uniform_t *)uniforms;
+
+    vec4 position(vertex.position, 1.0f);
+    vec4 world_pos = instance.model_matrix.mul_vec4(position);
+
+    varyings.tangent = instance.model_matrix3.mul_vec3(vertex.tangent).normalized();
+    varyings.world_pos = vec3(world_pos.x(), world_pos.y(), world_pos.z());
+    varyings.world_normal = instance.normal_matrix.mul_vec3(vertex.normal).normalized();
+    varyings.texcoords = vertex.texcoord;
+
+    return blin_uniforms->view_proj_matrix.mul_vec4(world_pos);
+}
+
+const vec4 blin_shader_t::fragment(const blin_varying_t &varyings, bool &discard) {
+    return vec4(shade(varyings, -1, 1.0f), 1.0f);
+}
+
+const vec3 blin_shader_t::shade(const blin_varying_t &varyings, int shadow_light, float visibility) {
+    const blin_varying_t *blin_varyings = &varyings;
     const blin_uniform_t *blin_uniforms = (const blin_uniform_t *)uniforms;
 
     vec3 normal = blin_varyings->world_normal.normalized();
     vec2 texcoords = blin_varyings->texcoords;
 
+    // 用texcoords的屏幕空间导数选择mipmap层级
+    const blin_varying_t *dfdx = (const blin_varying_t *)get_dfdx();
+    const blin_varying_t *dfdy = (const blin_varying_t *)get_dfdy();
+    vec2 duvdx = dfdx ? dfdx->texcoords : vec2(0.0f);
+    vec2 duvdy = dfdy ? dfdy->texcoords : vec2(0.0f);
+
     assert(blin_uniforms->diffuse_texture);
-    vec4 t_color = blin_uniforms->diffuse_texture->sample(texcoords);
+    vec4 t_color = blin_uniforms->diffuse_texture->sample(texcoords, duvdx, duvdy);
     vec3 color(t_color.x(), t_color.y(), t_color.z());
     
     if(blin_uniforms->normal_texture) {
-        vec4 t_normal = blin_uniforms->normal_texture->sample(texcoords);
+        vec4 t_normal = blin_uniforms->normal_texture->sample(texcoords, duvdx, duvdy);
         t_normal = t_normal * 2.0f - 1.0f;
         vec3 N = normal;
         vec3 T = blin_varyings->tangent.normalized();
@@ -78,7 +134,51 @@ const vec4 blin_shader_t::fragment_shader(const void *varyings, bool &discard) {
         float spec = pow(std::max(normal.dot(h), 0.0f), 64.0f);
         vec3 specular =  light_color * spec;
 
-        pixel_color = pixel_color + color * (ambient + (specular + diffuse) / dis);
+        vec3 direct = (specular + diffuse) / dis;
+        if(i == shadow_light) direct = direct * visibility;
+
+        pixel_color = pixel_color + color * (ambient + direct);
     }
-    return vec4(pixel_color, 1.0f);
-}
\ No newline at end of file
+    return pixel_color;
+}
+
+const vec4 blin_shadow_shader_t::fragment_shader(const void *varyings, bool &discard) {
+    return fragment(*(const blin_varying_t *)varyings, discard);
+}
+
+const vec4 blin_shadow_shader_t::fragment(const blin_varying_t &varyings, bool &discard) {
+    const blin_shadow_uniform_t *shadow_uniforms = (const blin_shadow_uniform_t *)uniforms;
+
+    float visibility = 1.0f;
+    if(shadow_uniforms->shadow_map) {
+        // 变换到光源的NDC，再换算成shadow map的uv和深度，深度的范围和方向由shadow map决定
+        vec4 light_pos = shadow_uniforms->light_matrix.mul_vec4(vec4(varyings.world_pos, 1.0f));
+        if(light_pos.w() > 0.0f) {
+            light_pos = light_pos * (1.0f / light_pos.w());
+            vec2 uv((light_pos.x() + 1.0f) * 0.5f, (light_pos.y() + 1.0f) * 0.5f);
+            float ref = shadow_uniforms->shadow_map->reference_depth(light_pos.z(), shadow_uniforms->depth_bias);
+            visibility = shadow_uniforms->shadow_map->sample_pcf(uv, ref, shadow_uniforms->pcf_radius);
+        }
+    }
+    return vec4(shade(varyings, shadow_uniforms->shadow_light, visibility), 1.0f);
+}
+
+const vec4 blin_transparent_shader_t::fragment_shader(const void *varyings, bool &discard) {
+    return fragment(*(const blin_varying_t *)varyings, discard);
+}
+
+const vec4 blin_transparent_shader_t::fragment(const blin_varying_t &varyings, bool &discard) {
+    const blin_transparent_uniform_t *transparent_uniforms = (const blin_transparent_uniform_t *)uniforms;
+    return vec4(shade(varyings, -1, 1.0f), transparent_uniforms->opacity);
+}
+
+template void draw_primitives<blin_shader_t>(framebuffer_t *, const vbo_t *, blin_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<blin_shader_t>(framebuffer_t *, const vbo_t *, const ibo_t *, blin_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives_instanced<blin_shader_t>(framebuffer_t *, const vbo_t *, const ibo_t *, const vbo_t *, blin_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void command_list_t::draw<blin_shader_t>(const vbo_t *, const ibo_t *, blin_shader_t *, const void *, int, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<blin_shadow_shader_t>(framebuffer_t *, const vbo_t *, blin_shadow_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<blin_shadow_shader_t>(framebuffer_t *, const vbo_t *, const ibo_t *, blin_shadow_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void command_list_t::draw<blin_shadow_shader_t>(const vbo_t *, const ibo_t *, blin_shadow_shader_t *, const void *, int, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<blin_transparent_shader_t>(framebuffer_t *, const vbo_t *, blin_transparent_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<blin_transparent_shader_t>(framebuffer_t *, const vbo_t *, const ibo_t *, blin_transparent_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void command_list_t::draw<blin_transparent_shader_t>(const vbo_t *, const ibo_t *, blin_transparent_shader_t *, const void *, int, PRIMITIVE_TYPE, const render_state_t *);
@@ -29,13 +29,76 @@ struct blin_uniform_t {
     /* lights */
     int num_of_point_lights;
     blin_point_light_t* point_lights;
+
+    /* 由blin_shader_t::prepare()在每次绘制前计算 */
+    mat4 mvp_matrix;
+    mat3 model_matrix3;
+    mat3 normal_matrix;
+    mat4 view_proj_matrix;
+};
+
+/* 实例化绘制时每个实例的属性，代替uniform中的model_matrix，由make_blin_instance计算 */
+struct blin_instance_t {
+    mat4 model_matrix;
+    mat3 model_matrix3;
+    mat3 normal_matrix;
+};
+
+const blin_instance_t make_blin_instance(const mat4& model_matrix);
+
+/* blin_shadow_shader_t使用的uniform，前半部分与blin_uniform_t相同 */
+struct blin_shadow_uniform_t : blin_uniform_t {
+    /* shadow，shadow_map为NULL时不计算阴影，需要按渲染shadow map时的深度状态创建 */
+    depth_texture_t* shadow_map;
+    mat4 light_matrix;  // 世界空间到光源裁剪空间，与渲染shadow map时的proj * view相同
+    int shadow_light;   // 投射阴影的点光源下标
+    float depth_bias;   // 向光源方向偏移的深度
+    int pcf_radius;
+};
+
+/* blin_transparent_shader_t使用的uniform */
+struct blin_transparent_uniform_t : blin_uniform_t {
+    float opacity;  // 输出的alpha
 };
 
 class blin_shader_t : public shader_t {
    public:
+    typedef vertex_t attribs_t;
+    typedef blin_varying_t varyings_t;
+    typedef blin_instance_t instance_attribs_t;
+
     blin_shader_t();
     const vec4 vertex_shader(const void* attribs, void* varyings) override;
+    const vec4 instance_vertex_shader(const void* attribs, const void* instance_attribs, void* varyings) override;
+    const vec4 fragment_shader(const void* varyings, bool& discard) override;
+    void prepare() override;
+
+    // 供draw_primitives<blin_shader_t>使用的非虚版本
+    const vec4 vertex(const vertex_t& vertex, blin_varying_t& varyings);
+    const vec4 vertex(const vertex_t& vertex, const blin_instance_t& instance, blin_varying_t& varyings);
+    const vec4 fragment(const blin_varying_t& varyings, bool& discard);
+
+   protected:
+    // 下标为shadow_light的点光源的漫反射和高光乘以visibility
+    const vec3 shade(const blin_varying_t& varyings, int shadow_light, float visibility);
+};
+
+// 带阴影的blin：用shadow map做PCF，uniform为blin_shadow_uniform_t
+class blin_shadow_shader_t : public blin_shader_t {
+   public:
     const vec4 fragment_shader(const void* varyings, bool& discard) override;
+
+    // 供draw_primitives<blin_shadow_shader_t>使用的非虚版本
+    const vec4 fragment(const blin_varying_t& varyings, bool& discard);
+};
+
+// 半透明的blin：输出的alpha为opacity，配合alpha_blend_state()在不透明物体之后从远到近绘制
+class blin_transparent_shader_t : public blin_shader_t {
+   public:
+    const vec4 fragment_shader(const void* varyings, bool& discard) override;
+
+    // 供draw_primitives<blin_transparent_shader_t>使用的非虚版本
+    const vec4 fragment(const blin_varying_t& varyings, bool& discard);
 };
 
 #endif  // BLINSHADER_H_
\ No newline at end of file
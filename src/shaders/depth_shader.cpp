@@ -0,0 +1,35 @@
+#include "depth_shader.h"
+
+#include "core/pipeline.h"
+
+depth_shader_t::depth_shader_t() : shader_t(0) {
+    // 只需要深度，光栅化阶段不插值任何varying
+    set_used_varyings(NO_VARYINGS);
+    set_may_discard(false);
+}
+
+const vec4 depth_shader_t::vertex_shader(const void *attribs, void *varyings) {
+    return vertex(*(const vertex_t *)attribs, *(depth_varying_t *)varyings);
+}
+
+const vec4 depth_shader_t::fragment_shader(const void *varyings, bool &discard) {
+    return fragment(*(const depth_varying_t *)varyings, discard);
+}
+
+void depth_shader_t::prepare() {
+    depth_uniform_t *depth_uniforms = (depth_uniform_t *)uniforms;
+    depth_uniforms->mvp_matrix = depth_uniforms->proj_matrix * depth_uniforms->view_matrix * depth_uniforms->model_matrix;
+}
+
+const vec4 depth_shader_t::vertex(const vertex_t &vertex, depth_varying_t &varyings) {
+    const depth_uniform_t *depth_uniforms = (const depth_uniform_t *)uniforms;
+    return depth_uniforms->mvp_matrix.mul_vec4(vec4(vertex.position, 1.0f));
+}
+
+const vec4 depth_shader_t::fragment(const depth_varying_t &varyings, bool &discard) {
+    return vec4(1.0f);
+}
+
+template void draw_primitives<depth_shader_t>(framebuffer_t *, const vbo_t *, depth_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<depth_shader_t>(framebuffer_t *, const vbo_t *, const ibo_t *, depth_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void command_list_t::draw<depth_shader_t>(const vbo_t *, const ibo_t *, depth_shader_t *, const void *, int, PRIMITIVE_TYPE, const render_state_t *);
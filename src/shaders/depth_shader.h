@@ -0,0 +1,33 @@
+#ifndef DEPTHSHADER_H_
+#define DEPTHSHADER_H_
+
+#include "core/api.h"
+
+// 只输出深度，用于shadow map和depth prepass
+struct depth_varying_t {};
+
+struct depth_uniform_t {
+    mat4 model_matrix;
+    mat4 view_matrix;
+    mat4 proj_matrix;
+
+    /* 由depth_shader_t::prepare()在每次绘制前计算 */
+    mat4 mvp_matrix;
+};
+
+class depth_shader_t : public shader_t {
+   public:
+    typedef vertex_t attribs_t;
+    typedef depth_varying_t varyings_t;
+
+    depth_shader_t();
+    const vec4 vertex_shader(const void* attribs, void* varyings) override;
+    const vec4 fragment_shader(const void* varyings, bool& discard) override;
+    void prepare() override;
+
+    // 供draw_primitives<depth_shader_t>使用的非虚版本
+    const vec4 vertex(const vertex_t& vertex, depth_varying_t& varyings);
+    const vec4 fragment(const depth_varying_t& varyings, bool& discard);
+};
+
+#endif  // DEPTHSHADER_H_
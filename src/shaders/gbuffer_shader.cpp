@@ -0,0 +1,24 @@
+#include "gbuffer_shader.h"
+
+#include "core/pipeline.h"
+
+void gbuffer_shader_t::prepare() {
+    blin_shader_t::prepare();
+    set_num_outputs(3);
+}
+
+const vec4 gbuffer_shader_t::fragment_shader(const void *varyings, bool &discard) {
+    return fragment(*(const blin_varying_t *)varyings, discard);
+}
+
+const vec4 gbuffer_shader_t::fragment(const blin_varying_t &varyings, bool &discard) {
+    const gbuffer_uniform_t *gbuffer_uniforms = (const gbuffer_uniform_t *)uniforms;
+    vec3 normal = varyings.world_normal.normalized();
+    write_output(1, vec4(normal * 0.5f + vec3(0.5f), 1.0f));
+    write_output(2, vec4((float)gbuffer_uniforms->object_id, 0.0f, 0.0f, 1.0f));
+    return vec4(shade(varyings, -1, 1.0f), 1.0f);
+}
+
+template void draw_primitives<gbuffer_shader_t>(framebuffer_t *, const vbo_t *, gbuffer_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<gbuffer_shader_t>(framebuffer_t *, const vbo_t *, const ibo_t *, gbuffer_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void command_list_t::draw<gbuffer_shader_t>(const vbo_t *, const ibo_t *, gbuffer_shader_t *, const void *, int, PRIMITIVE_TYPE, const render_state_t *);
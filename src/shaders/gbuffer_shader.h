@@ -0,0 +1,23 @@
+#ifndef GBUFFERSHADER_H_
+#define GBUFFERSHADER_H_
+
+#include "blin_shader.h"
+
+// 一次绘制写出G-buffer（MRT）：
+//     输出0：blin着色的颜色
+//     输出1：世界空间的法线，编码到[0, 1]
+//     输出2：物体编号（r通道），用于拾取，附件应为浮点格式
+struct gbuffer_uniform_t : blin_uniform_t {
+    int object_id;
+};
+
+class gbuffer_shader_t : public blin_shader_t {
+   public:
+    void prepare() override;
+    const vec4 fragment_shader(const void* varyings, bool& discard) override;
+
+    // 供draw_primitives<gbuffer_shader_t>使用的非虚版本
+    const vec4 fragment(const blin_varying_t& varyings, bool& discard);
+};
+
+#endif  // GBUFFERSHADER_H_
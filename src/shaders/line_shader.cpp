@@ -0,0 +1,34 @@
+#include "line_shader.h"
+
+#include "core/pipeline.h"
+
+line_shader_t::line_shader_t() : shader_t(sizeof(line_varying_t)) {
+    set_may_discard(false);
+}
+
+const vec4 line_shader_t::vertex_shader(const void *attribs, void *varyings) {
+    return vertex(*(const line_attribs_t *)attribs, *(line_varying_t *)varyings);
+}
+
+const vec4 line_shader_t::fragment_shader(const void *varyings, bool &discard) {
+    return fragment(*(const line_varying_t *)varyings, discard);
+}
+
+void line_shader_t::prepare() {
+    line_uniform_t *line_uniforms = (line_uniform_t *)uniforms;
+    line_uniforms->mvp_matrix = line_uniforms->proj_matrix * line_uniforms->view_matrix * line_uniforms->model_matrix;
+}
+
+const vec4 line_shader_t::vertex(const line_attribs_t &attribs, line_varying_t &varyings) {
+    const line_uniform_t *line_uniforms = (const line_uniform_t *)uniforms;
+    varyings.color = attribs.color;
+    return line_uniforms->mvp_matrix.mul_vec4(vec4(attribs.position, 1.0f));
+}
+
+const vec4 line_shader_t::fragment(const line_varying_t &varyings, bool &discard) {
+    return vec4(varyings.color, 1.0f);
+}
+
+template void draw_primitives<line_shader_t>(framebuffer_t *, const vbo_t *, line_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void draw_primitives<line_shader_t>(framebuffer_t *, const vbo_t *, const ibo_t *, line_shader_t *, PRIMITIVE_TYPE, const render_state_t *);
+template void command_list_t::draw<line_shader_t>(const vbo_t *, const ibo_t *, line_shader_t *, const void *, int, PRIMITIVE_TYPE, const render_state_t *);
@@ -0,0 +1,40 @@
+#ifndef LINESHADER_H_
+#define LINESHADER_H_
+
+#include "core/api.h"
+
+// 顶点颜色直接输出，用于法线、包围盒等调试用的直线
+struct line_attribs_t {
+    vec3 position;
+    vec3 color;
+};
+
+struct line_varying_t {
+    vec3 color;
+};
+
+struct line_uniform_t {
+    mat4 model_matrix;
+    mat4 view_matrix;
+    mat4 proj_matrix;
+
+    /* 由line_shader_t::prepare()在每次绘制前计算 */
+    mat4 mvp_matrix;
+};
+
+class line_shader_t : public shader_t {
+   public:
+    typedef line_attribs_t attribs_t;
+    typedef line_varying_t varyings_t;
+
+    line_shader_t();
+    const vec4 vertex_shader(const void* attribs, void* varyings) override;
+    const vec4 fragment_shader(const void* varyings, bool& discard) override;
+    void prepare() override;
+
+    // 供draw_primitives<line_shader_t>使用的非虚版本
+    const vec4 vertex(const line_attribs_t& attribs, line_varying_t& varyings);
+    const vec4 fragment(const line_varying_t& varyings, bool& discard);
+};
+
+#endif  // LINESHADER_H_
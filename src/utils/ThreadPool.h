@@ -1,6 +1,7 @@
 #ifndef UTILS_THREAD_POOL_H
 #define UTILS_THREAD_POOL_H
 
+#include <algorithm>
 #include <vector>
 #include <queue>
 #include <memory>
@@ -12,6 +13,7 @@
 #include <stdexcept>
 #include "Singleton.h"
 
+// number of workers when the core count can not be detected
 #define THREAD_NUM 4
 
 class ThreadPool : Singleton<ThreadPool> {
@@ -22,6 +24,7 @@ public:
     static auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
 
     static ThreadPool& getInstance();
+    static size_t size();
 
 private:
     ThreadPool();
@@ -40,7 +43,9 @@ private:
  
 // the constructor just launches some amount of workers
 inline ThreadPool::ThreadPool() : stop(false) {
-    for(size_t i = 0;i < THREAD_NUM; ++i)
+    size_t num = std::thread::hardware_concurrency();
+    if(num == 0) num = THREAD_NUM;
+    for(size_t i = 0;i < num; ++i)
         workers.emplace_back(
             [this]
             {
@@ -62,10 +67,14 @@ inline ThreadPool::ThreadPool() : stop(false) {
         );
 }
 
-ThreadPool& ThreadPool::getInstance()  {
+inline ThreadPool& ThreadPool::getInstance()  {
     return Singleton<ThreadPool>::getInstance();
 }
 
+inline size_t ThreadPool::size() {
+    return getInstance().workers.size();
+}
+
 // add new work item to the pool
 template<class F, class... Args>
 auto ThreadPool::enqueue(F&& f, Args&&... args) 
@@ -107,4 +116,22 @@ inline ThreadPool::~ThreadPool()
         worker.join();
 }
 
+// 把[0, height)按行分块，一块由调用线程处理，其余交给ThreadPool，全部完成后返回
+template <class Func>
+void parallel_rows(int height, const Func& func) {
+    int num_chunks = std::min((int)ThreadPool::size(), height);
+    if(num_chunks <= 1) {
+        func(0, height);
+        return ;
+    }
+    int rows = (height + num_chunks - 1) / num_chunks;
+    std::vector<std::future<void>> pending;
+    for(int begin = rows; begin < height; begin += rows) {
+        int end = std::min(begin + rows, height);
+        pending.push_back(ThreadPool::enqueue([&func, begin, end] { func(begin, end); }));
+    }
+    func(0, std::min(rows, height));
+    for(auto& future : pending) future.wait();
+}
+
 #endif